@@ -1,8 +1,21 @@
 #include <iostream>
 #include <string>
 #include <variant>
+#include <optional>
+#include <vector>
+#include <memory>
 #include "repl.h"
 
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#include <Psapi.h>
+#else
+#include <cstdio>
+#include <unistd.h>
+#endif
+
 using HulaScript::Runtime::value;
 using HulaScript::Runtime::instance;
 
@@ -29,7 +42,159 @@ private:
 	int step;
 };
 
-int main() {
+static size_t resident_kb() {
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+	return counters.WorkingSetSize / 1024;
+#else
+	long total_pages = 0, resident_pages = 0;
+	FILE* statm = fopen("/proc/self/statm", "r");
+	if (statm != NULL) {
+		if (fscanf(statm, "%ld %ld", &total_pages, &resident_pages) != 2) {
+			resident_pages = 0;
+		}
+		fclose(statm);
+	}
+	return static_cast<size_t>(resident_pages) * (sysconf(_SC_PAGESIZE) / 1024);
+#endif
+}
+
+//HulaScript24 --density-bench <instance count> <fresh|default|hibernated>
+//reports the resident memory each idle instance adds: fresh instances run nothing, the others run a small workload that leaves a few live tables behind
+//hibernated instances run it in high density mode and hibernate afterwards; run each mode in its own process, since freed memory isn't always returned to the os
+static int density_bench(uint32_t instance_count, std::string mode) {
+	static const char* workload[] = {
+		"score = [1, 2, 3]",
+		"name = \"player\"",
+		"function f(x) return x * 2 end",
+		"t = nil",
+		"i = 0",
+		"while i < 5000 do t = [i, i, i, i, i, i, i, i] i = i + 1 end"
+	};
+
+	size_t before = resident_kb();
+	std::vector<std::unique_ptr<HulaScript::repl_instance>> instances;
+	for (uint32_t i = 0; i < instance_count; i++) {
+		auto instance = std::make_unique<HulaScript::repl_instance>(std::nullopt, 256, 64, 1 << 20);
+		if (mode != "fresh") {
+			instance->set_high_density(mode == "hibernated");
+			for (const char* line : workload) { //one statement per evaluation
+				instance->write_input(line);
+				if (!std::holds_alternative<value>(instance->run())) {
+					std::cout << "workload failed at: " << line << std::endl;
+					return 1;
+				}
+			}
+			if (mode == "hibernated") {
+				instance->hibernate();
+			}
+		}
+		instances.push_back(std::move(instance));
+	}
+	size_t after = resident_kb();
+
+	std::cout << instance_count << " " << mode << " instances: " << static_cast<double>(after - before) / instance_count << " KB resident each" << std::endl;
+	return 0;
+}
+
+//evaluates one statement, and prints what went wrong if it doesn't produce expected
+static bool check_eval(HulaScript::repl_instance& instance, std::string line, std::optional<std::string> expected) {
+	std::string result;
+	auto input_res = instance.write_input(line);
+	if (std::holds_alternative<HulaScript::Compilation::error>(input_res)) {
+		result = std::get<HulaScript::Compilation::error>(input_res).to_print_string();
+	}
+	else {
+		auto run_res = instance.run();
+		if (std::holds_alternative<HulaScript::Runtime::error>(run_res)) {
+			result = std::get<HulaScript::Runtime::error>(run_res).to_print_string();
+		}
+		else if (std::holds_alternative<HulaScript::Compilation::error>(run_res)) {
+			result = std::get<HulaScript::Compilation::error>(run_res).to_print_string();
+		}
+		else if (!expected.has_value()) {
+			return true;
+		}
+		else {
+			result = instance.value_to_print_str(std::get<value>(run_res));
+		}
+	}
+
+	if (!expected.has_value() || result != expected.value()) {
+		std::cout << line << std::endl << "\tgave: " << result << std::endl;
+		if (expected.has_value()) {
+			std::cout << "\texpected: " << expected.value() << std::endl;
+		}
+		return false;
+	}
+	return true;
+}
+
+//a call site caches the method it last found, and must not trust it once the class is freed and its id reused
+//each caller is only called every period classes, so some caller still holds the id of a class freed long before
+static bool check_class_churn() {
+	HulaScript::repl_instance instance(std::nullopt, 256, 4096, 256);
+	bool passed = true;
+	for (int period = 128; passed && period <= 1536; period += 128) {
+		passed = check_eval(instance, "function call" + std::to_string(period) + "(obj) return obj.m() end", std::nullopt);
+	}
+	passed = passed && check_eval(instance, "class K0 x function m() return 0 end end", std::nullopt) && check_eval(instance, "o = K0(1)", std::nullopt);
+	for (int period = 128; passed && period <= 1536; period += 128) {
+		passed = check_eval(instance, "call" + std::to_string(period) + "(o)", std::to_string(0.0));
+	}
+
+	for (int i = 1; passed && i <= 3000; i++) {
+		std::string name = "K" + std::to_string(i);
+		std::string extra_method = i % 3 == 0 ? "function f(a) return a end " : ""; //keeps function ids from being reused in step with class ids
+		passed = check_eval(instance, "class " + name + " x " + extra_method + "function m() return " + std::to_string(i) + " end end", std::nullopt) && check_eval(instance, "o = " + name + "(1)", std::nullopt);
+		for (int period = 128; passed && period <= 1536; period += 128) {
+			if (i % period == 0) {
+				passed = check_eval(instance, "call" + std::to_string(period) + "(o)", std::to_string(static_cast<double>(i)));
+			}
+		}
+		passed = passed && check_eval(instance, name + " = nil", std::nullopt) && check_eval(instance, "t = [1, 2, 3, 4, 5, 6, 7, 8]", std::nullopt);
+	}
+	return passed;
+}
+
+static bool check_concat() {
+	HulaScript::repl_instance instance(std::nullopt, 256, 16, 256);
+	return check_eval(instance, "x = \"a\"", std::nullopt) &&
+		check_eval(instance, "x..\"b\"", "ab") &&
+		check_eval(instance, "x..x..x", "aaa") &&
+		check_eval(instance, "1..x", std::to_string(1.0) + "a") && //the number ends before the concatenation operator
+		check_eval(instance, "1.5..x", std::to_string(1.5) + "a") &&
+		check_eval(instance, "x..2", "a" + std::to_string(2.0));
+}
+
+//HulaScript24 --self-check
+//runs scripted regression checks against fresh instances
+static int self_check() {
+	static const std::pair<const char*, bool(*)()> checks[] = {
+		{ "class churn", check_class_churn },
+		{ "concatenation", check_concat }
+	};
+
+	int failures = 0;
+	for (auto& check : checks) {
+		bool passed = check.second();
+		std::cout << check.first << (passed ? ": passed" : ": FAILED") << std::endl;
+		if (!passed) {
+			failures++;
+		}
+	}
+	return failures == 0 ? 0 : 1;
+}
+
+int main(int argc, char** argv) {
+	if (argc == 4 && std::string(argv[1]) == "--density-bench") {
+		return density_bench(static_cast<uint32_t>(std::stoul(argv[2])), argv[3]);
+	}
+	if (argc == 2 && std::string(argv[1]) == "--self-check") {
+		return self_check();
+	}
+
 	static bool stop = false;
 	HulaScript::repl_instance instance(std::nullopt, 256, 16, 256);
 	instance.declare_func("range", [](value* args, uint32_t arg_c, HulaScript::Runtime::instance& instance) -> instance::result_t {
@@ -46,6 +211,9 @@ int main() {
 		std::cout << std::endl;
 		return value();
 	}, std::nullopt);
+	instance.declare_func("string_builder", [](value* args, uint32_t arg_c, HulaScript::Runtime::instance& instance)->instance::result_t {
+		return instance.make_foreign_resource(new HulaScript::Runtime::string_builder());
+	}, 0);
 	instance.declare_func("stop", [](value* args, uint32_t arg_c, HulaScript::Runtime::instance& instance)->instance::result_t {
 		stop = true;
 		return value();
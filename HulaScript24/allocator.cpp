@@ -0,0 +1,43 @@
+#include <cstdlib>
+#include <cassert>
+#include "sparsepp/spp_stdint.h"
+#include "sparsepp/spp_dlalloc.h"
+#include "allocator.h"
+
+using namespace HulaScript;
+
+allocator& allocator::system() {
+	class malloc_allocator : public allocator {
+	public:
+		void* allocate(size_t bytes) override {
+			return malloc(bytes);
+		}
+
+		void release(void* ptr, size_t bytes) override {
+			free(ptr);
+		}
+	};
+
+	static malloc_allocator shared;
+	return shared;
+}
+
+mspace_allocator::mspace_allocator() : space(spp::create_mspace(0, 0)) {
+	assert(space != NULL);
+}
+
+mspace_allocator::~mspace_allocator() {
+	spp::destroy_mspace(space);
+}
+
+void* mspace_allocator::allocate(size_t bytes) {
+	return spp::mspace_malloc(space, bytes);
+}
+
+void mspace_allocator::release(void* ptr, size_t bytes) {
+	spp::mspace_free(space, ptr);
+}
+
+void mspace_allocator::trim() {
+	spp::mspace_trim(space, 0);
+}
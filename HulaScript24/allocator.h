@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+
+namespace HulaScript {
+	//where an instance gets memory for strings; sizes are passed back on release, so pools and arenas needn't record them
+	//an allocator must outlive every instance using it
+	class allocator {
+	public:
+		virtual ~allocator() { }
+
+		//returns NULL when out of memory
+		virtual void* allocate(size_t bytes) = 0;
+		virtual void release(void* ptr, size_t bytes) = 0;
+
+		//gives free memory back to the os, if the allocator can; called when an instance hibernates
+		virtual void trim() { }
+
+		//malloc and free; used by instances that aren't given an allocator
+		static allocator& system();
+	};
+
+	//a private dlmalloc space from the bundled sparsepp; instances don't contend with each other for it, and destroying it returns all of its memory at once
+	class mspace_allocator : public allocator {
+	public:
+		mspace_allocator();
+		~mspace_allocator();
+
+		mspace_allocator(const mspace_allocator&) = delete;
+		mspace_allocator& operator=(const mspace_allocator&) = delete;
+
+		void* allocate(size_t bytes) override;
+		void release(void* ptr, size_t bytes) override;
+		void trim() override;
+	private:
+		void* space;
+	};
+}
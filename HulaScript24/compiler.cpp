@@ -1,6 +1,7 @@
 #include <sstream>
 #include <cmath>
 #include <cassert>
+#include <algorithm>
 #include "hash.h"
 #include "compiler.h"
 
@@ -11,6 +12,10 @@ compiler::compiler(instance& target_instance, bool report_src_locs) : max_global
 	func_decl_stack.push_back({ .name = "top level local context", .max_locals = 0, .captured_vars = spp::sparse_hash_set<uint64_t>(4)});
 }
 
+compiler::compiler(const compiler& source, instance& target_instance) : repl_stop_parsing(source.repl_stop_parsing), report_src_locs(source.report_src_locs), max_globals(source.max_globals),
+	active_variables(source.active_variables), scope_stack(source.scope_stack), func_decl_stack(source.func_decl_stack), loop_stack(source.loop_stack),
+	declared_toplevel_locals(source.declared_toplevel_locals), declared_globals(source.declared_globals), loaded_functions(source.loaded_functions), emitted_call_sites(source.emitted_call_sites), max_instruction(source.max_instruction), target_instance(target_instance) { }
+
 #define UNWRAP_RES_AND_HANDLE(RESNAME, RES, HANDLE) auto RESNAME = RES; if(std::holds_alternative<error>(RESNAME)) { HANDLE; return std::get<error>(RESNAME); }
 
 #define UNWRAP_RES(RESNAME, RES) UNWRAP_RES_AND_HANDLE(RESNAME, RES, {});
@@ -89,7 +94,7 @@ std::optional<error> compiler::compile_value(tokenizer& tokenizer, std::vector<i
 					}
 
 					current_section.push_back({ .op = opcode::LOAD_LOCAL, .operand = 0 }); //load capture table, which is always local variable 0 in functions
-					current_section.push_back({ .op = opcode::LOAD_CONSTANT, .operand = target_instance.add_constant_strhash(id_hash)});
+					current_section.push_back({ .op = opcode::LOAD_CONSTANT, .operand = add_str_constant(id, func_decl_stack.back())});
 					current_section.push_back({ .op = opcode::LOAD_TABLE_ELEM });
 				}
 				else {
@@ -142,7 +147,7 @@ std::optional<error> compiler::compile_value(tokenizer& tokenizer, std::vector<i
 	case token_type::MINUS:
 		SCAN;
 		if (tokenizer.match_last(token_type::NUMBER)) {
-			current_section.push_back({ .op = opcode::LOAD_CONSTANT, .operand = target_instance.add_constant(Runtime::value(-token.number())) });
+			emit_number(-tokenizer.last_token().number(), current_section);
 			SCAN;
 		}
 		else {
@@ -156,11 +161,11 @@ std::optional<error> compiler::compile_value(tokenizer& tokenizer, std::vector<i
 		current_section.push_back({ .op = opcode::NOT });
 		break;
 	case token_type::NUMBER:
-		current_section.push_back({ .op = opcode::LOAD_CONSTANT, .operand = target_instance.add_constant(Runtime::value(token.number())) });
+		emit_number(token.number(), current_section);
 		SCAN;
 		break;
 	case token_type::STRING_LITERAL: {
-		current_section.push_back({ .op = opcode::LOAD_CONSTANT, .operand = target_instance.add_constant(Runtime::value((char*)token.str().c_str())) });
+		current_section.push_back({ .op = opcode::LOAD_CONSTANT, .operand = add_str_constant(token.str(), func_decl_stack.back()) });
 		SCAN;
 		break;
 	}
@@ -169,11 +174,11 @@ std::optional<error> compiler::compile_value(tokenizer& tokenizer, std::vector<i
 		current_section.push_back({ .op = opcode::PUSH_NIL });
 		break;
 	case token_type::TRUE:
-		current_section.push_back({ .op = opcode::LOAD_CONSTANT, .operand = target_instance.add_constant(Runtime::value(1.0)) });
+		emit_number(1.0, current_section);
 		SCAN;
 		break;
 	case token_type::FALSE:
-		current_section.push_back({ .op = opcode::LOAD_CONSTANT, .operand = target_instance.add_constant(Runtime::value(0.0)) });
+		emit_number(0.0, current_section);
 		SCAN;
 		break;
 	case token_type::TABLE:
@@ -202,8 +207,7 @@ std::optional<error> compiler::compile_value(tokenizer& tokenizer, std::vector<i
 				MATCH_AND_SCAN(token_type::COMMA);
 			}
 			current_section.push_back({ .op = opcode::DUPLICATE });
-			HulaScript::Runtime::value val((double)length);
-			current_section.push_back({ .op = opcode::LOAD_CONSTANT, .operand = target_instance.add_constant_key(val) });
+			emit_number((double)length, current_section);
 			UNWRAP(compile_expression(tokenizer, current_section, ip_src_map, 0, false));
 			current_section.push_back({ .op = opcode::STORE_TABLE_ELEM });
 			current_section.push_back({ .op = opcode::DISCARD_TOP });
@@ -290,24 +294,62 @@ std::optional<error> compiler::compile_value(tokenizer& tokenizer, std::vector<i
 			SCAN;
 			MATCH(token_type::IDENTIFIER);
 			uint64_t prop_hash = str_hash(tokenizer.last_token().str().c_str());
-			if (value_is_self && !func_decl_stack.back().class_decl.value()->properties.contains(prop_hash)) {
-				std::stringstream ss;
-				ss << "Class " << func_decl_stack.back().class_decl.value()->name << " doesn't have property " << tokenizer.last_token().str() << '.';
-				return error(etype::SYMBOL_NOT_FOUND, ss.str(), tokenizer.last_token_loc());
-			}
-			current_section.push_back({ .op = opcode::LOAD_CONSTANT, .operand = target_instance.add_constant_strhash(prop_hash) });
+
+			std::string prop_name = tokenizer.last_token().str();
+			source_loc prop_loc = tokenizer.last_token_loc();
 			SCAN;
 
+			//properties of self are resolved to their fixed slot in the class layout
+			std::optional<uint32_t> self_slot = std::nullopt;
+			if (value_is_self) {
+				auto prop_it = func_decl_stack.back().class_decl.value()->properties.find(prop_hash);
+				if (prop_it != func_decl_stack.back().class_decl.value()->properties.end()) {
+					self_slot = prop_it->second;
+				}
+				else if (!tokenizer.match_last(token_type::OPEN_PAREN)) { //anything else on self must be a method call
+					std::stringstream ss;
+					ss << "Class " << func_decl_stack.back().class_decl.value()->name << " doesn't have property " << prop_name << '.';
+					return error(etype::SYMBOL_NOT_FOUND, ss.str(), prop_loc);
+				}
+			}
+
 			if (tokenizer.match_last(token_type::SET)) {
 				loc = tokenizer.last_token_loc();
 				SCAN;
+				if (!self_slot.has_value()) {
+					current_section.push_back({ .op = opcode::LOAD_CONSTANT, .operand = add_str_constant(prop_name, func_decl_stack.back()) });
+				}
 				UNWRAP(compile_expression(tokenizer, current_section, ip_src_map, 0, false));
 				ip_src_map.insert({ static_cast<uint32_t>(current_section.size()), loc });
-				current_section.push_back({ .op = opcode::STORE_TABLE_ELEM });
+				if (self_slot.has_value()) {
+					current_section.push_back({ .op = opcode::STORE_TABLE_SLOT, .operand = self_slot.value() });
+				}
+				else {
+					current_section.push_back({ .op = opcode::STORE_TABLE_ELEM });
+				}
 				current_section.push_back({ .op = opcode::DISCARD_TOP });
 				return std::nullopt;
 			}
+			else if (self_slot.has_value()) {
+				current_section.push_back({ .op = opcode::LOAD_TABLE_SLOT, .operand = self_slot.value() });
+				is_statement = false;
+				value_is_self = false;
+				break;
+			}
+			else if (tokenizer.match_last(token_type::OPEN_PAREN)) { //method call
+				SCAN;
+				current_section.push_back({ .op = opcode::PUSH_SCRATCHPAD });
+				UNWRAP_RES(arg_res, compile_arguments(tokenizer, current_section, ip_src_map));
+
+				ip_src_map.insert({ static_cast<uint32_t>(current_section.size()), loc });
+				current_section.push_back({ .op = opcode::POP_SCRATCHPAD });
+				current_section.push_back({ .op = opcode::CALL_METHOD, .operand = emit_method_call_site(prop_name, std::get<uint32_t>(arg_res)) });
+				is_statement = true;
+				value_is_self = false;
+				break;
+			}
 			else {
+				current_section.push_back({ .op = opcode::LOAD_CONSTANT, .operand = add_str_constant(prop_name, func_decl_stack.back()) });
 				current_section.push_back({ .op = opcode::LOAD_TABLE_ELEM });
 				is_statement = false;
 				value_is_self = false;
@@ -340,20 +382,11 @@ std::optional<error> compiler::compile_value(tokenizer& tokenizer, std::vector<i
 			SCAN;
 
 			current_section.push_back({ .op = opcode::PUSH_SCRATCHPAD });
-			uint32_t length = 0;
-			while (!tokenizer.match_last(token_type::CLOSE_PAREN) && !tokenizer.match_last(token_type::END_OF_SOURCE))
-			{
-				if (length > 0) {
-					MATCH_AND_SCAN(token_type::COMMA);
-				}
-				UNWRAP(compile_expression(tokenizer, current_section, ip_src_map, 0, false));
-				length++;
-			}
-			MATCH_AND_SCAN(token_type::CLOSE_PAREN);
+			UNWRAP_RES(arg_res, compile_arguments(tokenizer, current_section, ip_src_map));
 
 			ip_src_map.insert({ static_cast<uint32_t>(current_section.size()), loc });
 			current_section.push_back({ .op = opcode::POP_SCRATCHPAD });
-			current_section.push_back({ .op = opcode::CALL, .operand = length });
+			current_section.push_back({ .op = opcode::CALL, .operand = std::get<uint32_t>(arg_res) });
 			is_statement = true;
 			value_is_self = false;
 			break;
@@ -391,11 +424,12 @@ std::optional<error> compiler::compile_expression(tokenizer& tokenizer, std::vec
 		1, //and
 		1, //or
 		3, //nil coaleasing operator
+		4, //concatenate
 	};
 
 	UNWRAP(compile_value(tokenizer, current_section, ip_src_map, false, repl_mode)); //lhs
 
-	while (tokenizer.last_token().type >= token_type::PLUS && tokenizer.last_token().type <= token_type::NIL_COALESING && min_precs[tokenizer.last_token().type - token_type::PLUS] > min_prec)
+	while (tokenizer.last_token().type >= token_type::PLUS && tokenizer.last_token().type <= token_type::CONCAT && min_precs[tokenizer.last_token().type - token_type::PLUS] > min_prec)
 	{
 		token_type op_type = tokenizer.last_token().type;
 		SCAN;
@@ -406,6 +440,18 @@ std::optional<error> compiler::compile_expression(tokenizer& tokenizer, std::vec
 			UNWRAP(compile_expression(tokenizer, current_section, ip_src_map, min_precs[op_type - token_type::PLUS], false));
 			current_section[jump_addr].operand = static_cast<uint32_t>(current_section.size() - jump_addr);
 		}
+		else if (op_type == token_type::AND || op_type == token_type::OR) {
+			//the rhs is only evaluated if the lhs doesn't already decide the result; if it is, the lhs stays on the stack for the regular and/or
+			uint32_t jump_addr = static_cast<uint32_t>(current_section.size());
+			current_section.push_back({ .op = op_type == token_type::AND ? opcode::IF_FALSE_JUMP_AHEAD : opcode::IF_TRUE_JUMP_AHEAD });
+			UNWRAP(compile_expression(tokenizer, current_section, ip_src_map, min_precs[op_type - token_type::PLUS], false));
+			current_section.push_back({ .op = (opcode)((op_type - token_type::PLUS) + opcode::ADD) });
+			current_section[jump_addr].operand = static_cast<uint32_t>(current_section.size() - jump_addr);
+		}
+		else if (op_type == token_type::CONCAT) {
+			UNWRAP(compile_expression(tokenizer, current_section, ip_src_map, min_precs[op_type - token_type::PLUS], false));
+			current_section.push_back({ .op = opcode::CONCAT });
+		}
 		else {
 			UNWRAP(compile_expression(tokenizer, current_section, ip_src_map, min_precs[op_type - token_type::PLUS], false));
 			current_section.push_back({ .op = (opcode)((op_type - token_type::PLUS) + opcode::ADD) });
@@ -415,6 +461,20 @@ std::optional<error> compiler::compile_expression(tokenizer& tokenizer, std::vec
 	return std::nullopt;
 }
 
+std::variant<uint32_t, error> compiler::compile_arguments(tokenizer& tokenizer, std::vector<instruction>& current_section, std::map<uint32_t, source_loc>& ip_src_map) {
+	uint32_t length = 0;
+	while (!tokenizer.match_last(token_type::CLOSE_PAREN) && !tokenizer.match_last(token_type::END_OF_SOURCE))
+	{
+		if (length > 0) {
+			MATCH_AND_SCAN(token_type::COMMA);
+		}
+		UNWRAP(compile_expression(tokenizer, current_section, ip_src_map, 0, false));
+		length++;
+	}
+	MATCH_AND_SCAN(token_type::CLOSE_PAREN);
+	return length;
+}
+
 std::optional<error> compiler::compile_statement(tokenizer& tokenizer, std::vector<instruction>& current_section, std::map<uint32_t, source_loc>& ip_src_map, bool repl_mode) {
 	token& token = tokenizer.last_token();
 	source_loc& begin_loc = tokenizer.last_token_loc();
@@ -591,6 +651,11 @@ std::optional<error> compiler::compile_function(std::string name, tokenizer& tok
 		ss << "A constructor for class " << class_decl.value()->name << "; cannot redeclare constructor.";
 		return error(etype::SYMBOL_ALREADY_EXISTS, ss.str(), begin_loc);
 	}
+	if (class_decl.has_value() && class_decl.value()->properties.contains(str_hash(name.c_str()))) {
+		std::stringstream ss;
+		ss << "Class " << class_decl.value()->name << " already defines property " << name << "; cannot declare method with the same name.";
+		return error(etype::SYMBOL_ALREADY_EXISTS, ss.str(), begin_loc);
+	}
 	std::vector<std::string> param_ids;
 	std::vector<uint64_t> param_hashes;
 	MATCH_AND_SCAN(token_type::OPEN_PAREN); 
@@ -643,7 +708,7 @@ std::optional<error> compiler::compile_function(std::string name, tokenizer& tok
 		UNWRAP_AND_HANDLE(compile_statement(tokenizer, func_instructions, function_src_locs, false), {
 			unwind_locals(func_instructions, 0, false);
 			func_decl_stack.pop_back();
-			target_instance.available_function_ids.push_back(func_id);
+			target_instance.function_entries.remove(func_id);
 			tokenizer.current_function_name = std::nullopt;
 		});
 	}
@@ -651,7 +716,7 @@ std::optional<error> compiler::compile_function(std::string name, tokenizer& tok
 	MATCH_AND_SCAN_AND_HANDLE(token_type::END_BLOCK, {
 		unwind_locals(func_instructions, 0, false);
 		func_decl_stack.pop_back();
-		target_instance.available_function_ids.push_back(func_id);
+		target_instance.function_entries.remove(func_id);
 	});
 	unwind_locals(func_instructions, 0, false);
 	{
@@ -665,14 +730,14 @@ std::optional<error> compiler::compile_function(std::string name, tokenizer& tok
 			}
 			else {
 				uint64_t name_hash = str_hash(name.c_str());
-				class_decl.value()->methods.insert({ name_hash, func_id });
+				class_decl.value()->methods.insert({ name_hash, std::make_pair(name, func_id) });
 			}
 		}
 
 		func_instructions.push_back({ .op = opcode::FUNCTION_END, .operand = expected_params });
 		func_instructions[1].operand = func_decl_stack.back().max_locals;
-		uint32_t old_size = static_cast<uint32_t>(target_instance.loaded_instructions.size());
-		target_instance.loaded_instructions.insert(target_instance.loaded_instructions.end(), func_instructions.begin(), func_instructions.end());
+		allocate_non_escaping_tables(func_instructions);
+		uint32_t old_size = load_function(func_id, func_instructions, func_decl_stack.back(), expected_params);
 		
 		if (report_src_locs) {
 			for (std::pair<uint32_t, source_loc> loc : function_src_locs) {
@@ -688,7 +753,7 @@ std::optional<error> compiler::compile_function(std::string name, tokenizer& tok
 				current_section.push_back({ .op = opcode::DUPLICATE });
 
 				auto var_it = active_variables.find(captured_var);
-				uint32_t prop_str_id = target_instance.add_constant_strhash(captured_var);
+				uint32_t prop_str_id = add_str_constant(var_it->second.name, func_decl_stack[func_decl_stack.size() - 2]);
 				current_section.push_back({ .op = opcode::LOAD_CONSTANT, .operand = prop_str_id });
 
 				if (var_it->second.func_id < func_decl_stack.size() - 2) { //this is a captured 
@@ -705,6 +770,7 @@ std::optional<error> compiler::compile_function(std::string name, tokenizer& tok
 			}
 
 			current_section.push_back({ .op = opcode::MAKE_CLOSURE, .operand = func_id });
+			func_decl_stack[func_decl_stack.size() - 2].referenced_func_ids.insert(func_id);
 		}
 	}
 	func_decl_stack.pop_back();
@@ -718,8 +784,8 @@ std::optional<error> compiler::compile_class(tokenizer& tokenizer, std::vector<i
 
 	class_declaration declaration = {
 		.name = tokenizer.last_token().str(),
-		.properties = spp::sparse_hash_set<uint64_t>(12),
-		.methods = spp::sparse_hash_map<uint64_t, uint32_t>(4),
+		.properties = spp::sparse_hash_map<uint64_t, uint32_t>(12),
+		.methods = spp::sparse_hash_map<uint64_t, std::pair<std::string, uint32_t>>(4),
 	};
 	uint64_t name_hash = str_hash(declaration.name.c_str());
 	variable_symbol sym = {
@@ -739,7 +805,8 @@ std::optional<error> compiler::compile_class(tokenizer& tokenizer, std::vector<i
 	current_section.push_back({ .op = opcode::ALLOCATE_FIXED });
 	while (tokenizer.match_last(token_type::IDENTIFIER))
 	{
-		uint64_t id = str_hash(tokenizer.last_token().str().c_str());
+		std::string prop_name = tokenizer.last_token().str();
+		uint64_t id = str_hash(prop_name.c_str());
 
 		if (declaration.properties.contains(id)) {
 			std::stringstream ss;
@@ -747,21 +814,25 @@ std::optional<error> compiler::compile_class(tokenizer& tokenizer, std::vector<i
 			return error(etype::SYMBOL_ALREADY_EXISTS, ss.str(), tokenizer.last_token_loc());
 		}
 
-		declaration.properties.insert(id);
+		declaration.properties.insert({ id, static_cast<uint32_t>(ordered_properties.size()) });
 		ordered_properties.push_back(id);
 		SCAN;
 
+		//every property gets a slot in the template, so instances share one fixed key layout
+		current_section.push_back({ .op = opcode::DUPLICATE });
+		current_section.push_back({ .op = opcode::LOAD_CONSTANT, .operand = add_str_constant(prop_name, func_decl_stack.back()) });
 		if (tokenizer.match_last(token_type::SET)) {
 			SCAN;
-			current_section.push_back({ .op = opcode::DUPLICATE });
-			current_section.push_back({ .op = opcode::LOAD_CONSTANT, .operand = target_instance.add_constant_strhash(id) });
 			UNWRAP(compile_expression(tokenizer, current_section, ip_src_map, 0, false));
-			current_section.push_back({ .op = opcode::STORE_TABLE_ELEM });
-			current_section.push_back({ .op = opcode::DISCARD_TOP });
 			default_value_properties.insert(id);
 		}
+		else {
+			current_section.push_back({ .op = opcode::PUSH_NIL });
+		}
+		current_section.push_back({ .op = opcode::STORE_TABLE_ELEM });
+		current_section.push_back({ .op = opcode::DISCARD_TOP });
 	}
-	current_section[alloc_table_ip].operand = static_cast<uint32_t>(default_value_properties.size());
+	current_section[alloc_table_ip].operand = static_cast<uint32_t>(ordered_properties.size());
 
 	while (tokenizer.match_last(token_type::FUNCTION))
 	{
@@ -775,34 +846,30 @@ std::optional<error> compiler::compile_class(tokenizer& tokenizer, std::vector<i
 	}
 	MATCH_AND_SCAN(token_type::END_BLOCK);
 
+	//the constructor keeps the method names alive, since class instances can only be made through it
+	function_declaration constructor_decl = {
+		.name = declaration.name,
+		.max_locals = 0,
+		.captured_vars = spp::sparse_hash_set<uint64_t>(4)
+	};
+
+	std::vector<std::pair<Runtime::value, uint32_t>> method_table;
+	method_table.reserve(declaration.methods.size());
+	for (auto& method : declaration.methods) {
+		method_table.push_back(std::make_pair(target_instance.constants[add_str_constant(method.second.first, constructor_decl)], method.second.second));
+	}
+	uint32_t class_id = target_instance.emit_class(method_table, static_cast<uint32_t>(ordered_properties.size()));
+	constructor_decl.referenced_class_ids.push_back(class_id);
+
 	std::vector<instruction> func_instructions;
 	uint32_t func_id = target_instance.emit_function_start(func_instructions);
 	uint32_t probe_ip = static_cast<uint32_t>(func_instructions.size());
 	func_instructions.push_back({ .op = opcode::PROBE_LOCALS });
 	func_instructions.push_back({ .op = opcode::DECL_LOCAL, .operand = 0 });
 	
-	func_instructions.push_back({ .op = opcode::ALLOCATE_FIXED, .operand = static_cast<uint32_t>(declaration.properties.size() + declaration.methods.size()) });
-	func_instructions.push_back({ .op = opcode::PUSH_SCRATCHPAD });
-	for (uint64_t id : default_value_properties) {
-		uint32_t prop_hash_id = target_instance.add_constant_strhash(id);
-		func_instructions.push_back({ .op = opcode::PEEK_SCRATCHPAD });
-		func_instructions.push_back({ .op = opcode::LOAD_CONSTANT, .operand = prop_hash_id});
-		func_instructions.push_back({ .op = opcode::LOAD_LOCAL, .operand = 0 });
-		func_instructions.push_back({ .op = opcode::LOAD_CONSTANT, .operand = prop_hash_id });
-		func_instructions.push_back({ .op = opcode::LOAD_TABLE_ELEM });
-		func_instructions.push_back({ .op = opcode::STORE_TABLE_ELEM });
-		func_instructions.push_back({ .op = opcode::DISCARD_TOP });
-	}
-	for (auto func : declaration.methods) {
-		func_instructions.push_back({ .op = opcode::PEEK_SCRATCHPAD });
-		func_instructions.push_back({ .op = opcode::LOAD_CONSTANT, .operand = target_instance.add_constant_strhash(func.first) });
-		func_instructions.push_back({ .op = opcode::PEEK_SCRATCHPAD });
-		func_instructions.push_back({ .op = opcode::MAKE_CLOSURE, .operand = func.second });
-		func_instructions.push_back({ .op = opcode::STORE_TABLE_ELEM });
-		func_instructions.push_back({ .op = opcode::DISCARD_TOP });
-	}
-
-	func_instructions.push_back({ .op = opcode::POP_SCRATCHPAD });
+	//copy the template table (the capture table of the constructor); methods are found through the class
+	func_instructions.push_back({ .op = opcode::LOAD_LOCAL, .operand = 0 });
+	func_instructions.push_back({ .op = opcode::ALLOCATE_CLASS, .operand = class_id });
 
 	uint32_t param_length;
 	if (declaration.constructor.has_value()) {
@@ -815,13 +882,12 @@ std::optional<error> compiler::compile_class(tokenizer& tokenizer, std::vector<i
 	else {
 		func_instructions[probe_ip].operand = 2;
 		func_instructions.push_back({ .op = opcode::DECL_LOCAL, .operand = 1 });
-		for (auto it = ordered_properties.rbegin(); it != ordered_properties.rend(); it++) {
-			if (!default_value_properties.contains(*it)) {
+		for (uint32_t slot = static_cast<uint32_t>(ordered_properties.size()); slot-- > 0;) {
+			if (!default_value_properties.contains(ordered_properties[slot])) {
 				func_instructions.push_back({ .op = opcode::PUSH_SCRATCHPAD });
 				func_instructions.push_back({ .op = opcode::LOAD_LOCAL, .operand = 1 });
-				func_instructions.push_back({ .op = opcode::LOAD_CONSTANT, .operand = target_instance.add_constant_strhash(*it) });
 				func_instructions.push_back({ .op = opcode::POP_SCRATCHPAD });
-				func_instructions.push_back({ .op = opcode::STORE_TABLE_ELEM });
+				func_instructions.push_back({ .op = opcode::STORE_TABLE_SLOT, .operand = slot });
 				func_instructions.push_back({ .op = opcode::DISCARD_TOP });
 			}
 		}
@@ -831,7 +897,13 @@ std::optional<error> compiler::compile_class(tokenizer& tokenizer, std::vector<i
 	func_instructions.push_back({ .op = opcode::RETURN });
 	func_instructions.push_back({ .op = opcode::FUNCTION_END, .operand = param_length });
 
-	target_instance.loaded_instructions.insert(target_instance.loaded_instructions.end(), func_instructions.begin(), func_instructions.end());
+	for (auto& method : declaration.methods) {
+		constructor_decl.referenced_func_ids.insert(method.second.second);
+	}
+	if (declaration.constructor.has_value()) {
+		constructor_decl.referenced_func_ids.insert(declaration.constructor.value().first);
+	}
+	load_function(func_id, func_instructions, constructor_decl, param_length);
 
 	current_section.push_back({ .op = opcode::MAKE_CLOSURE, .operand = func_id });
 	current_section.push_back({ .op = opcode::DECL_GLOBAL, .operand = sym.local_id });
@@ -842,6 +914,10 @@ std::optional<error> compiler::compile(tokenizer& tokenizer, bool repl_mode) {
 	std::vector<instruction> repl_section;
 	max_instruction = static_cast<uint32_t>(target_instance.loaded_instructions.size());
 	func_decl_stack.back().max_locals = target_instance.top_level_local_offset;
+	func_decl_stack.back().referenced_func_ids.clear(); //top level code has no function entry
+	func_decl_stack.back().referenced_const_str_ids.clear();
+	func_decl_stack.back().referenced_const_num_ids.clear();
+	func_decl_stack.back().method_call_sites.clear();
 	max_globals = target_instance.global_offset;
 	
 	std::map<uint32_t, source_loc> ip_src_map;
@@ -914,6 +990,7 @@ std::optional<error> compiler::compile(tokenizer& tokenizer, bool repl_mode) {
 	if (repl_stop_parsing) {
 		repl_stop_parsing = false;
 	}
+	target_instance.top_level_code_start = static_cast<uint32_t>(target_instance.loaded_instructions.size());
 	if (declared_toplevel_locals.size() > 0) {
 		target_instance.loaded_instructions.push_back({ .op = opcode::PROBE_LOCALS, .operand = static_cast<uint32_t>(declared_toplevel_locals.size()) });
 	}
@@ -922,8 +999,14 @@ std::optional<error> compiler::compile(tokenizer& tokenizer, bool repl_mode) {
 	}
 	uint32_t old_size = static_cast<uint32_t>(target_instance.loaded_instructions.size());
 	target_instance.loaded_instructions.insert(target_instance.loaded_instructions.end(), repl_section.begin(), repl_section.end());
+	for (uint32_t const_id : func_decl_stack.back().referenced_const_str_ids) {
+		target_instance.toplevel_const_strs.push_back(target_instance.constants[const_id].str());
+	}
+	target_instance.toplevel_call_sites.insert(target_instance.toplevel_call_sites.end(), func_decl_stack.back().method_call_sites.begin(), func_decl_stack.back().method_call_sites.end());
 	declared_globals.clear();
 	declared_toplevel_locals.clear();
+	loaded_functions.clear();
+	emitted_call_sites.clear();
 	if (report_src_locs) {
 		for (std::pair<uint32_t, source_loc> loc : ip_src_map) {
 			target_instance.ip_src_locs.insert({ old_size + loc.first, loc.second });
@@ -1015,17 +1098,205 @@ void compiler::unwind_error() {
 	declared_globals.clear();
 
 	target_instance.loaded_instructions.erase(target_instance.loaded_instructions.begin() + max_instruction, target_instance.loaded_instructions.end());
-	
-	for (auto it = target_instance.ip_src_locs.lower_bound(max_globals); it != target_instance.ip_src_locs.end();) {
+	for (auto it = target_instance.ip_src_locs.lower_bound(max_instruction); it != target_instance.ip_src_locs.end();) {
 		it = target_instance.ip_src_locs.erase(it);
 	}
+
+	//unregister functions whose code was just discarded; those loaded into holes free them again
+	for (uint32_t func_id : loaded_functions) {
+		instance::loaded_function_entry& entry = target_instance.function_entries[func_id];
+		target_instance.release_code(entry.start_address - 1, entry.length + 1);
+		target_instance.function_entries.remove(func_id);
+	}
+	loaded_functions.clear();
+	target_instance.release_method_call_sites(emitted_call_sites); //including those of functions that failed to compile
+}
+
+//follows a table pushed by the instruction at ip through straight line code, until every copy of it on the evaluation stack has been consumed
+compiler::table_use compiler::trace_table(const std::vector<instruction>& instructions, uint32_t ip, bool allow_decl, uint32_t& decl_ip) {
+	std::vector<bool> stack = { true }; //values pushed since ip; true is a copy of the table
+	size_t copies = 1;
+	bool declared = false;
+
+	for (uint32_t i = ip + 1; i < instructions.size(); i++) {
+		uint32_t pops;
+		uint32_t pushes;
+		uint32_t table_operand = UINT32_MAX; //the operand, counted from the deepest, that may be the table
+		switch (instructions[i].op)
+		{
+		case opcode::ADD: case opcode::SUB: case opcode::MUL: case opcode::DIV: case opcode::MOD: case opcode::EXP:
+		case opcode::LESS: case opcode::MORE: case opcode::LESS_EQUAL: case opcode::MORE_EQUAL: case opcode::EQUALS: case opcode::NOT_EQUALS:
+		case opcode::AND: case opcode::OR: case opcode::CONCAT:
+			pops = 2; pushes = 1;
+			break;
+		case opcode::NEGATE: case opcode::NOT: case opcode::ALLOCATE_DYN: case opcode::STORE_LOCAL:
+			pops = 1; pushes = 1;
+			break;
+		case opcode::LOAD_LOCAL: case opcode::LOAD_GLOBAL: case opcode::LOAD_CONSTANT: case opcode::PUSH_INT: case opcode::PUSH_NIL: case opcode::ALLOCATE_FIXED: case opcode::ALLOCATE_FRAME:
+			pops = 0; pushes = 1;
+			break;
+		case opcode::STORE_GLOBAL:
+			pops = 1; pushes = 0;
+			break;
+		case opcode::DISCARD_TOP:
+			pops = 1; pushes = 0; table_operand = 0;
+			break;
+		case opcode::DECL_LOCAL:
+			pops = 1; pushes = 0;
+			if (allow_decl && !declared && !stack.empty() && stack.back()) {
+				declared = true;
+				decl_ip = i;
+				table_operand = 0;
+			}
+			break;
+		case opcode::DUPLICATE:
+			if (!stack.empty() && stack.back()) {
+				stack.push_back(true);
+				copies++;
+			}
+			else {
+				stack.push_back(false);
+			}
+			continue;
+		case opcode::LOAD_TABLE_ELEM:
+			pops = 2; pushes = 1; table_operand = 0;
+			break;
+		case opcode::STORE_TABLE_ELEM:
+			pops = 3; pushes = 1; table_operand = 0;
+			break;
+		case opcode::LOAD_TABLE_SLOT:
+			pops = 1; pushes = 1; table_operand = 0;
+			break;
+		case opcode::STORE_TABLE_SLOT:
+			pops = 2; pushes = 1; table_operand = 0;
+			break;
+		default:
+			return table_use::ESCAPES; //calls, returns and jumps are never followed
+		}
+
+		for (uint32_t j = 0; j < pops; j++) {
+			if (stack.empty()) {
+				continue; //values from before ip are never the table
+			}
+			if (stack.back()) {
+				if (pops - 1 - j != table_operand) {
+					return table_use::ESCAPES;
+				}
+				copies--;
+			}
+			stack.pop_back();
+		}
+		if (copies == 0) {
+			return declared ? table_use::DECLARED : table_use::INDEXED;
+		}
+		for (uint32_t j = 0; j < pushes; j++) {
+			stack.push_back(false);
+		}
+	}
+	return table_use::ESCAPES;
+}
+
+//table literals that never leave their function, whether on the evaluation stack or through a local that's only ever indexed, are allocated in the frame and freed on return
+void compiler::allocate_non_escaping_tables(std::vector<instruction>& instructions) {
+	std::vector<std::pair<uint32_t, uint32_t>> loops;
+	std::map<uint32_t, uint32_t> local_decls; //local id to number of declarations and stores
+	for (uint32_t i = 0; i < instructions.size(); i++) {
+		switch (instructions[i].op)
+		{
+		case opcode::JUMP_BACK:
+		case opcode::COND_JUMP_BACK:
+			loops.push_back(std::make_pair(i - instructions[i].operand, i));
+			break;
+		case opcode::DECL_LOCAL:
+		case opcode::DECL_TOPLVL_LOCAL:
+		case opcode::STORE_LOCAL:
+			local_decls[instructions[i].operand]++;
+			break;
+		default:
+			break;
+		}
+	}
+
+	for (uint32_t i = 0; i < instructions.size(); i++) {
+		if (instructions[i].op != opcode::ALLOCATE_FIXED) {
+			continue;
+		}
+		if (std::any_of(loops.begin(), loops.end(), [i](std::pair<uint32_t, uint32_t> loop) -> bool { return i >= loop.first && i < loop.second; })) {
+			continue; //frame tables are only freed on return, so a loop would keep allocating them
+		}
+
+		uint32_t decl_ip = 0;
+		table_use use = trace_table(instructions, i, true, decl_ip);
+		if (use == table_use::DECLARED) {
+			uint32_t local_id = instructions[decl_ip].operand;
+			if (local_decls[local_id] != 1) {
+				continue;
+			}
+			for (uint32_t j = 0; use == table_use::DECLARED && j < instructions.size(); j++) {
+				uint32_t unused;
+				if (instructions[j].op == opcode::LOAD_LOCAL && instructions[j].operand == local_id && trace_table(instructions, j, false, unused) != table_use::INDEXED) {
+					use = table_use::ESCAPES;
+				}
+			}
+		}
+		if (use != table_use::ESCAPES) {
+			instructions[i].op = opcode::ALLOCATE_FRAME;
+		}
+	}
+}
+
+uint32_t compiler::load_function(uint32_t func_id, std::vector<instruction>& func_instructions, function_declaration& declaration, uint32_t parameter_count) {
+	uint32_t old_size = target_instance.allocate_code(func_instructions); //never moved afterwards
+
+	instance::loaded_function_entry entry = {
+		.start_address = old_size + 1, //skip the function instruction
+		.referenced_func_ids = std::vector<uint32_t>(declaration.referenced_func_ids.begin(), declaration.referenced_func_ids.end()),
+		.length = static_cast<uint32_t>(func_instructions.size() - 1),
+		.parameter_count = parameter_count
+	};
+	entry.referenced_const_nums.insert(entry.referenced_const_nums.end(), declaration.referenced_const_num_ids.begin(), declaration.referenced_const_num_ids.end());
+	entry.referenced_class_ids = declaration.referenced_class_ids;
+	entry.method_call_sites = declaration.method_call_sites;
+	entry.referenced_const_strs.reserve(declaration.referenced_const_str_ids.size());
+	for (uint32_t const_id : declaration.referenced_const_str_ids) {
+		entry.referenced_const_strs.push_back(target_instance.constants[const_id].str());
+	}
+	target_instance.function_entries[func_id] = entry;
+	loaded_functions.push_back(func_id);
+
+	return old_size;
+}
+
+void compiler::emit_number(double number, std::vector<instruction>& instructions) {
+	//integers that fit in an operand are pushed directly, bypassing the constant table
+	if (number >= INT32_MIN && number <= INT32_MAX && number == floor(number) && !(number == 0 && std::signbit(number))) {
+		instructions.push_back({ .op = opcode::PUSH_INT, .operand = static_cast<uint32_t>(static_cast<int32_t>(number)) });
+	}
+	else {
+		uint32_t const_id = target_instance.add_constant(Runtime::value(number));
+		func_decl_stack.back().referenced_const_num_ids.insert(const_id);
+		instructions.push_back({ .op = opcode::LOAD_CONSTANT, .operand = const_id });
+	}
 }
 
 void compiler::emit_call_method(std::string method_name, std::vector<instruction>& instructions) {
-	uint64_t method_id_hash = str_hash(method_name.c_str());
-	instructions.push_back({ .op = opcode::LOAD_CONSTANT, .operand = target_instance.add_constant_strhash(method_id_hash) });
-	instructions.push_back({ .op = opcode::LOAD_TABLE_ELEM });
-	instructions.push_back({ .op = opcode::CALL, .operand = 0 });
+	instructions.push_back({ .op = opcode::CALL_METHOD, .operand = emit_method_call_site(method_name, 0) });
+}
+
+//call sites belong to the code of the function being compiled, or to the top level code
+uint32_t compiler::emit_method_call_site(const std::string& method_name, uint32_t argument_count) {
+	Runtime::value name = target_instance.constants[add_str_constant(method_name, func_decl_stack.back())];
+	uint32_t call_site_id = target_instance.emit_method_call_site(name, argument_count);
+	func_decl_stack.back().method_call_sites.push_back(call_site_id);
+	emitted_call_sites.push_back(call_site_id);
+	return call_site_id;
+}
+
+//string constants double as table keys, so each function records the ones it loads for the garbage collector
+uint32_t compiler::add_str_constant(const std::string& str, function_declaration& referencer) {
+	uint32_t const_id = target_instance.add_constant_str(str.c_str());
+	referencer.referenced_const_str_ids.insert(const_id);
+	return const_id;
 }
 
 std::optional<error> compiler::validate_symbol_availability(std::string id, std::string symbol_type, source_loc loc) {
@@ -16,13 +16,16 @@ namespace HulaScript::Compilation {
 	public:
 		compiler(HulaScript::Runtime::instance& instance, bool report_src_locs);
 
+		//continues from source's declarations, compiling into a clone of source's instance
+		compiler(const compiler& source, HulaScript::Runtime::instance& instance);
+
 		std::optional<error> compile(tokenizer& tokenizer, bool repl_mode);
 
 		std::optional<uint32_t> declare_global(std::string name) {
 			uint64_t hash = str_hash(name.c_str());
 			auto it = active_variables.find(hash);
 			if (it == active_variables.end()) {
-				if (target_instance.global_offset == target_instance.max_globals) {
+				if (target_instance.global_offset == target_instance.max_globals || !target_instance.global_memory.commit((target_instance.global_offset + 1) * sizeof(HulaScript::Runtime::value))) {
 					return std::nullopt;
 				}
 
@@ -47,8 +50,8 @@ namespace HulaScript::Compilation {
 
 		struct class_declaration {
 			std::string name;
-			spp::sparse_hash_set<uint64_t> properties;
-			spp::sparse_hash_map<uint64_t, uint32_t> methods;
+			spp::sparse_hash_map<uint64_t, uint32_t> properties; //property name hashes and their fixed slot in every instance
+			spp::sparse_hash_map<uint64_t, std::pair<std::string, uint32_t>> methods; //method names and their function ids
 
 			std::optional<std::pair<uint32_t, uint32_t>> constructor = std::nullopt;
 		};
@@ -58,6 +61,13 @@ namespace HulaScript::Compilation {
 			uint32_t max_locals;
 			spp::sparse_hash_set<uint64_t> captured_vars;
 			std::optional<class_declaration*> class_decl = std::nullopt;
+
+			//used to build the function's runtime entry; the garbage collector traces through these
+			spp::sparse_hash_set<uint32_t> referenced_func_ids = spp::sparse_hash_set<uint32_t>(4);
+			spp::sparse_hash_set<uint32_t> referenced_const_str_ids = spp::sparse_hash_set<uint32_t>(4);
+			spp::sparse_hash_set<uint32_t> referenced_const_num_ids = spp::sparse_hash_set<uint32_t>(4);
+			std::vector<uint32_t> referenced_class_ids;
+			std::vector<uint32_t> method_call_sites; //owned by the function's code, and released with it
 		};
 
 		struct lexical_scope {
@@ -89,6 +99,8 @@ namespace HulaScript::Compilation {
 
 		std::vector<uint64_t> declared_toplevel_locals; //locals declared DURING the compilation session; cleared afterwards
 		std::vector<uint64_t> declared_globals; //globals declared DURING the compilation session; cleared afterwards
+		std::vector<uint32_t> loaded_functions; //functions loaded DURING the compilation session; cleared afterwards
+		std::vector<uint32_t> emitted_call_sites; //method call sites emitted DURING the compilation session; cleared afterwards
 		uint32_t max_instruction;
 
 		instance& target_instance;
@@ -98,13 +110,25 @@ namespace HulaScript::Compilation {
 		std::optional<error> compile_statement(tokenizer& tokenizer, std::vector<instruction>& current_section, std::map<uint32_t, source_loc>& ip_src_map, bool repl_mode);
 		std::optional<error> compile_function(std::string name, tokenizer& tokenizer, std::vector<instruction>& current_section, std::optional<class_declaration*> class_decl, source_loc begin);
 		std::optional<error> compile_class(tokenizer& tokenizer, std::vector<instruction>& current_section, std::map<uint32_t, source_loc>& ip_src_map);
+		std::variant<uint32_t, error> compile_arguments(tokenizer& tokenizer, std::vector<instruction>& current_section, std::map<uint32_t, source_loc>& ip_src_map);
 		std::optional<error> compile_block(tokenizer& tokenizer, std::vector<instruction>& current_section, std::map<uint32_t, source_loc>& ip_src_map, bool(*stop_cond)(token_type));
 
 		void unwind_locals(std::vector<instruction>& instructions, uint32_t probe_ip, bool use_unwind_ins);
 		void unwind_loop(uint32_t cond_check_ip, uint32_t finish_ip, std::vector<instruction>& instructions);
 		void unwind_error();
+		enum class table_use {
+			ESCAPES,
+			INDEXED, //only ever indexed or discarded
+			DECLARED //indexed, and declared as a local once
+		};
+		static table_use trace_table(const std::vector<instruction>& instructions, uint32_t ip, bool allow_decl, uint32_t& decl_ip);
+		void allocate_non_escaping_tables(std::vector<instruction>& instructions);
 
 		void emit_call_method(std::string method_name, std::vector<instruction>& instructions);
+		uint32_t emit_method_call_site(const std::string& method_name, uint32_t argument_count);
+		void emit_number(double number, std::vector<instruction>& instructions);
+		uint32_t add_str_constant(const std::string& str, function_declaration& referencer);
+		uint32_t load_function(uint32_t func_id, std::vector<instruction>& func_instructions, function_declaration& declaration, uint32_t parameter_count);
 
 		std::optional<error> validate_symbol_availability(std::string id, std::string symbol_type, source_loc loc);
 	};
@@ -48,19 +48,49 @@ namespace HulaScript::Runtime {
 	class foreign_object : public instance::foreign_resource {
 	protected:
 		void register_member(std::string name, std::function<instance::result_t(value*, uint32_t, instance&)> func, std::optional<uint32_t> expected_params) {
-			methods.insert({ hash_combine(str_hash(name.c_str()), vtype::STRING), foreign_function(name, func, expected_params, this) });
+			methods.insert({ key_str_hash(name.c_str(), name.size()), std::make_pair(name, foreign_function(name, func, expected_params, this)) });
 		}
 	public:
 		instance::result_t load_key(value& key_value, instance& instance) override {
-			uint64_t hash = key_value.compute_key_hash();
-			auto it = methods.find(hash);
-			if (it == methods.end()) {
+			if (key_value.type() != vtype::STRING) {
+				return value();
+			}
+
+			string_header* key = key_value.str();
+			auto it = methods.find(key->hash);
+			if (it == methods.end() || it->second.first != std::string_view(key->chars(), key->length)) {
 				return value();
 			}
 			ref();
-			return instance.make_foreign_resource(new foreign_function(it->second));
+			return instance.make_foreign_resource(new foreign_function(it->second.second));
+		}
+	private:
+		spp::sparse_hash_map<uint64_t, std::pair<std::string, foreign_function>> methods; //member names are kept to verify hash matches
+	};
+
+	//accumulates pieces into one growable buffer; cheaper than repeated concatenation when a string is built in a loop
+	class string_builder : public foreign_object {
+	public:
+		string_builder() {
+			register_member("append", [this](value* args, uint32_t arg_c, instance& instance) -> instance::result_t {
+				for (uint_fast32_t i = 0; i < arg_c; i++) {
+					buffer.append(instance.value_to_print_str(args[i]));
+				}
+				return instance.make_foreign_resource(this);
+			}, std::nullopt);
+			register_member("build", [this](value* args, uint32_t arg_c, instance& instance) -> instance::result_t {
+				return instance.make_string(buffer);
+			}, 0);
+			register_member("clear", [this](value* args, uint32_t arg_c, instance& instance) -> instance::result_t {
+				buffer.clear();
+				return value();
+			}, 0);
+		}
+
+		std::string to_print_string() override {
+			return "String Builder";
 		}
 	private:
-		spp::sparse_hash_map<uint64_t, foreign_function> methods;
+		std::string buffer;
 	};
 }
\ No newline at end of file
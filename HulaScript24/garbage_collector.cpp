@@ -1,103 +1,472 @@
 #include <cstdint>
-#include <queue>
-#include <set>
 #include <vector>
+#include <deque>
+#include <atomic>
+#include <mutex>
+#include <thread>
 #include <cassert>
 #include <algorithm>
 #include <cstring>
 #include "hash.h"
 #include "instance.h"
 
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <xmmintrin.h>
+#endif
+
 using namespace HulaScript::Runtime;
 
-std::optional<instance::gc_block> instance::allocate_block(uint32_t element_count) {
-	auto free_table_it = free_tables.lower_bound(element_count);
-	if (free_table_it != free_tables.end()) {
-		gc_block new_entry = {
-			.table_start = free_table_it->second.table_start,
-			.allocated_capacity = element_count
-		};
-		uint32_t unused_elem_count = free_table_it->second.allocated_capacity - element_count;
-		free_tables.erase(free_table_it);
+static inline void prefetch(const void* address) {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+	_mm_prefetch(static_cast<const char*>(address), _MM_HINT_T0);
+#elif defined(__GNUC__)
+	__builtin_prefetch(address);
+#endif
+}
 
-		if (unused_elem_count > 0) {
-			free_tables.insert({ unused_elem_count, {
-				.table_start = new_entry.table_start + new_entry.allocated_capacity,
-				.allocated_capacity = unused_elem_count
-			}});
+//finds a free block of at least element_count elements in constant time, returning what's left over to the free lists
+std::optional<instance::gc_block> instance::take_free_block(uint32_t element_count) {
+	uint32_t size_class = block_class(element_count);
+	uint32_t first_fitting_class = size_class;
+	if (size_class >= exact_block_classes) {
+		//blocks in a power of two class may be smaller than the request; every class above fits
+		std::vector<gc_block>& candidates = free_blocks[size_class];
+		if (!candidates.empty() && candidates.back().allocated_capacity >= element_count) {
+			first_fitting_class = size_class;
+		}
+		else {
+			first_fitting_class = size_class + 1;
 		}
+	}
 
-		return std::make_optional(new_entry);
+	uint64_t fitting_classes = first_fitting_class < 64 ? free_block_classes & (~static_cast<uint64_t>(0) << first_fitting_class) : 0;
+	if (fitting_classes == 0) {
+		return std::nullopt;
 	}
 
-	if (table_offset + element_count > max_table) {
-		garbage_collect(gc_collection_mode::STANDARD);
-		if ((table_offset + element_count) > max_table) {
-			return std::nullopt; //out of memory cannot allocate table
+	std::vector<gc_block>& free_list = free_blocks[std::countr_zero(fitting_classes)];
+	gc_block block = free_list.back();
+	free_list.pop_back();
+	if (free_list.empty()) {
+		free_block_classes &= ~(static_cast<uint64_t>(1) << std::countr_zero(fitting_classes));
+	}
+
+	if (block.allocated_capacity > element_count) {
+		add_free_block({
+			.table_start = block.table_start + element_count,
+			.allocated_capacity = block.allocated_capacity - element_count
+		});
+		block.allocated_capacity = element_count;
+	}
+	return block;
+}
+
+void instance::add_free_block(gc_block block) {
+	uint32_t size_class = block_class(block.allocated_capacity);
+	free_blocks[size_class].push_back(block);
+	free_block_classes |= static_cast<uint64_t>(1) << size_class;
+}
+
+//allocates in the old generation without collecting
+std::optional<instance::gc_block> instance::allocate_old_block(uint32_t element_count) {
+	if (element_count > 0) {
+		std::optional<gc_block> free_block = take_free_block(element_count);
+		if (free_block.has_value()) {
+			allocated_elems += element_count;
+			collection_policy.add_elem_debt(element_count);
+			return free_block;
 		}
 	}
 
+	if (table_offset + element_count > std::min(nursery_start, table_soft_limit)) {
+		return std::nullopt;
+	}
+
 	gc_block new_entry = {
 		.table_start = table_offset, //table_start,
 		.allocated_capacity = element_count //length
 	};
 	table_offset += element_count;
+	allocated_elems += element_count;
+	collection_policy.add_elem_debt(element_count);
 
 	return std::make_optional(new_entry);
 }
 
-//elements are initialized by default to nil
-std::optional<uint64_t> instance::allocate_table(uint32_t element_count) {
-	std::optional<gc_block> res = allocate_block(element_count);
-	auto ptr = (std::pair<uint64_t, uint32_t>*)(element_count > 0 ? malloc(element_count * sizeof(std::pair<uint64_t, uint32_t>)) : NULL);
+std::optional<instance::gc_block> instance::allocate_block(uint32_t element_count) {
+	if (element_count >= large_table_elems) {
+		std::optional<gc_block> res = allocate_large_block(element_count);
+		if (!res.has_value()) {
+			garbage_collect(gc_collection_mode::STANDARD);
+			res = allocate_large_block(element_count);
+		}
+		return res;
+	}
+
+	std::optional<gc_block> res = allocate_old_block(element_count);
+	if (res.has_value()) {
+		return res;
+	}
+
+	garbage_collect(gc_collection_mode::STANDARD);
+	res = allocate_old_block(element_count);
+	if (res.has_value()) {
+		return res;
+	}
+
+	//commit more of the reservation before resorting to compaction
+	if (table_offset + element_count > table_soft_limit && table_offset + element_count <= nursery_start && grow_table_heap(table_offset + element_count)) {
+		return allocate_old_block(element_count);
+	}
+
+	//the free blocks are too small; moving the live tables together turns them into one
+	if (table_offset > allocated_elems) {
+		compact_tables();
+		gc_reset_generations();
+	}
+	if ((table_offset + element_count) > max_table || !grow_table_heap(table_offset + element_count)) {
+		return std::nullopt; //out of memory cannot allocate table
+	}
+
+	//the nursery is empty after a full collection, so it can give up space to the old generation
+	nursery_start = std::max(nursery_start, table_offset + element_count);
+	nursery_offset = nursery_start;
+	return allocate_old_block(element_count);
+}
+
+//survivors are promoted even past the soft limit, since collecting again wouldn't free them
+std::optional<instance::gc_block> instance::allocate_promoted_block(uint32_t element_count) {
+	std::optional<gc_block> res = allocate_old_block(element_count);
+	if (!res.has_value() && table_offset + element_count <= nursery_start && grow_table_heap(table_offset + element_count)) {
+		res = allocate_old_block(element_count);
+	}
+	return res;
+}
+
+//raises the soft limit to at least min_elems, doubling it so a growing heap commits memory rarely
+bool instance::grow_table_heap(size_t min_elems) {
+	if (min_elems <= table_soft_limit) {
+		return true;
+	}
+	if (min_elems > max_table) {
+		return false;
+	}
+
+	size_t new_limit = std::min(max_table, std::max(min_elems, table_soft_limit * 2));
+	if (!table_elem_memory.commit(new_limit * sizeof(value)) || !table_key_memory.commit(new_limit * sizeof(table_key))) {
+		return false;
+	}
+	table_soft_limit = new_limit;
+	return true;
+}
+
+//gives memory back to the os once the heap is less than half used; the nursery above the soft limit keeps its pages
+void instance::trim_table_heap() {
+	size_t target = std::min(max_table, std::max({ table_soft_limit_floor, table_offset, allocated_elems * 2 }));
+	if (target * 2 > table_soft_limit) {
+		return;
+	}
+
+	size_t end = std::min(table_soft_limit, nursery_start);
+	table_elem_memory.decommit(target * sizeof(value), end * sizeof(value));
+	table_key_memory.decommit(target * sizeof(table_key), end * sizeof(table_key));
+	table_soft_limit = target;
+}
+
+void instance::hibernate() {
+	assert(exec_depth == 0);
+	assert(local_offset == 0); //only top level locals are roots, since the slot generations of dead tables start over below
+	garbage_collect(gc_collection_mode::FINALIZE_COLLECT_RETURN);
+	if (table_offset > allocated_elems) {
+		compact_tables();
+	}
+
+	//the nursery goes first, since its pages may overlap the committed prefix
+	if (nursery_start < max_table) {
+		table_elem_memory.decommit_range(nursery_start * sizeof(value), (max_table - nursery_start) * sizeof(value));
+		table_key_memory.decommit_range(nursery_start * sizeof(table_key), (max_table - nursery_start) * sizeof(table_key));
+		nursery_start = max_table;
+		nursery_offset = max_table;
+	}
+
+	//everything above the live tables is dropped, then the floor is committed again; its pages take no memory until they're touched
+	table_elem_memory.decommit(table_offset * sizeof(value), table_soft_limit * sizeof(value));
+	table_key_memory.decommit(table_offset * sizeof(table_key), table_soft_limit * sizeof(table_key));
+	table_soft_limit = table_offset;
+	grow_table_heap(std::min(max_table, std::max(table_offset, table_soft_limit_floor)));
+
+	if (frame_committed_end > frame_space_start) {
+		table_elem_memory.decommit_range(frame_space_start * sizeof(value), (frame_committed_end - frame_space_start) * sizeof(value));
+		table_key_memory.decommit_range(frame_space_start * sizeof(table_key), (frame_committed_end - frame_space_start) * sizeof(table_key));
+		frame_committed_end = frame_space_start;
+	}
+	local_memory.decommit(top_level_local_offset * sizeof(value), max_locals * sizeof(value));
+
+	table_entries.trim(); //unreachable tables are all gone, so no stale table ids remain
+	young_tables.shrink_to_fit();
+	remembered_tables.shrink_to_fit();
+	gray_tables.shrink_to_fit();
+	gray_strs.shrink_to_fit();
+	gray_functions.shrink_to_fit();
+	frame_tables.shrink_to_fit();
+	active_strs.shrink_to_fit();
+	loaded_instructions.shrink_to_fit();
+	for (std::vector<gc_block>& free_list : free_blocks) {
+		free_list.shrink_to_fit();
+	}
+	str_allocator.trim();
+}
 
-	if (!res.has_value() || (element_count > 0 && ptr == NULL)) {
+//first fit; large tables are few, so the free ranges are too
+std::optional<instance::gc_block> instance::allocate_large_block(uint32_t element_count) {
+	size_t capacity = std::min(round_to_large_granularity(element_count), static_cast<size_t>(UINT32_MAX));
+	auto it = std::find_if(free_large_ranges.begin(), free_large_ranges.end(), [capacity](const std::pair<size_t, size_t>& range) -> bool {
+		return range.second >= capacity;
+	});
+	if (it == free_large_ranges.end()) {
 		return std::nullopt;
 	}
 
-	uint64_t id;
-	if (available_table_ids.empty()) {
-		id = table_entries.size();
-		table_entries.resize(id + 1);
+	size_t start = it->first;
+	size_t remaining = it->second - capacity;
+	free_large_ranges.erase(it);
+	if (remaining > 0) {
+		free_large_ranges.insert({ start + capacity, remaining });
 	}
-	else {
-		id = available_table_ids.back();
-		available_table_ids.pop_back();
+	if (!table_elem_memory.commit_range(start * sizeof(value), capacity * sizeof(value)) || !table_key_memory.commit_range(start * sizeof(table_key), capacity * sizeof(table_key))) {
+		free_large_range(start, capacity);
+		return std::nullopt;
+	}
+
+	large_elems += capacity;
+	collection_policy.add_elem_debt(capacity);
+	return gc_block{
+		.table_start = start,
+		.allocated_capacity = static_cast<uint32_t>(capacity)
+	};
+}
+
+//grows a large block in place when the range right after it is free, so growing a huge table doesn't copy it
+bool instance::extend_large_block(gc_block& block, uint32_t element_count) {
+	size_t capacity = std::min(round_to_large_granularity(element_count), static_cast<size_t>(UINT32_MAX));
+	size_t end = block.table_start + block.allocated_capacity;
+	auto next = free_large_ranges.find(end);
+	if (next == free_large_ranges.end() || block.allocated_capacity + next->second < capacity) {
+		return false;
+	}
+
+	size_t extra = capacity - block.allocated_capacity;
+	if (!table_elem_memory.commit_range(end * sizeof(value), extra * sizeof(value)) || !table_key_memory.commit_range(end * sizeof(table_key), extra * sizeof(table_key))) {
+		return false;
+	}
+	size_t remaining = next->second - extra;
+	free_large_ranges.erase(next);
+	if (remaining > 0) {
+		free_large_ranges.insert({ end + extra, remaining });
+	}
+
+	block.allocated_capacity = static_cast<uint32_t>(capacity);
+	large_elems += extra;
+	collection_policy.add_elem_debt(extra);
+	return true;
+}
+
+void instance::release_large_block(gc_block block) {
+	table_elem_memory.decommit_range(block.table_start * sizeof(value), block.allocated_capacity * sizeof(value));
+	table_key_memory.decommit_range(block.table_start * sizeof(table_key), block.allocated_capacity * sizeof(table_key));
+	large_elems -= block.allocated_capacity;
+	free_large_range(block.table_start, block.allocated_capacity);
+}
+
+//returns a range to the large object space, merging it with its free neighbours
+void instance::free_large_range(size_t start, size_t length) {
+	auto next = free_large_ranges.lower_bound(start);
+	if (next != free_large_ranges.end() && next->first == start + length) {
+		length += next->second;
+		next = free_large_ranges.erase(next);
+	}
+	if (next != free_large_ranges.begin()) {
+		auto prev = std::prev(next);
+		if (prev->first + prev->second == start) {
+			start = prev->first;
+			length += prev->second;
+			free_large_ranges.erase(prev);
+		}
+	}
+	free_large_ranges.insert({ start, length });
+}
+
+//elements are initialized by default to nil
+std::optional<uint64_t> instance::allocate_table(uint32_t element_count) {
+	gc_allocation_step();
+
+	std::optional<gc_block> res;
+	bool young = false;
+	if (nursery_capacity > 0 && collection_phase == GC_IDLE && element_count < large_table_elems) {
+		if (nursery_offset + element_count > max_table || young_tables.size() >= max_table - nursery_start) {
+			gc_minor_collect();
+		}
+		if (nursery_offset + element_count <= max_table && collection_phase == GC_IDLE) {
+			res = gc_block{
+				.table_start = nursery_offset,
+				.allocated_capacity = element_count
+			};
+			nursery_offset += element_count;
+			young = true;
+		}
+	}
+	if (!young) {
+		res = allocate_block(element_count);
+	}
+	if (!res.has_value()) {
+		return std::nullopt;
 	}
 
 	table_entry new_entry = {
-		.key_hashes = ptr,
-		.key_hash_capacity = element_count,
 		.used_elems = 0,
 		.block = res.value()
 	};
-	table_entries.set(id, new_entry);
 	
+	uint64_t id = table_entries.add(new_entry);
+	table_marks.assign(table_entries.slot_of(id), allocate_marked(table_entries.slot_of(id)));
+	if (young) {
+		table_entries[id].young = true;
+		young_tables.push_back(id);
+	}
 	return id;
 }
 
+std::optional<uint64_t> instance::allocate_frame_table(uint32_t element_count) {
+	size_t start = frame_table_offset;
+	bool fits = start + element_count <= frame_space_end;
+	if (fits && start + element_count > frame_committed_end) {
+		size_t end = std::min(frame_space_end, round_to_large_granularity(start + element_count));
+		fits = table_elem_memory.commit_range(frame_committed_end * sizeof(value), (end - frame_committed_end) * sizeof(value)) &&
+			table_key_memory.commit_range(frame_committed_end * sizeof(table_key), (end - frame_committed_end) * sizeof(table_key));
+		if (fits) {
+			frame_committed_end = end;
+		}
+	}
+
+	std::optional<uint64_t> res;
+	if (fits) {
+		table_entry new_entry = {
+			.used_elems = 0,
+			.block = {
+				.table_start = start,
+				.allocated_capacity = element_count
+			}
+		};
+		res = table_entries.add(new_entry);
+		table_marks.assign(table_entries.slot_of(res.value()), allocate_marked(table_entries.slot_of(res.value())));
+		frame_table_offset += element_count;
+	}
+	else {
+		res = allocate_table(element_count);
+	}
+
+	if (res.has_value()) {
+		frame_tables.push_back({ .id = res.value(), .depth = return_stack.size(), .start = start });
+	}
+	return res;
+}
+
+//frees the tables allocated by every frame at least depth calls deep
+void instance::release_frame_tables(size_t depth) {
+	while (!frame_tables.empty() && frame_tables.back().depth >= depth) {
+		frame_table table = frame_tables.back();
+		frame_tables.pop_back();
+		frame_table_offset = table.start;
+		if (!table_entries.contains(table.id)) {
+			continue; //already collected, after the local holding it went out of scope
+		}
+
+		table_entry& entry = table_entries[table.id];
+		if (entry.remembered) {
+			std::erase(remembered_tables, table.id);
+			entry.remembered = false;
+		}
+		release_block(entry.block);
+		if (collection_phase == GC_MARKING) {
+			//gray lists may still name it, so the sweep frees the emptied entry instead
+			entry.used_elems = 0;
+			entry.block = {
+				.table_start = 0,
+				.allocated_capacity = 0
+			};
+		}
+		else {
+			table_entries.remove(table.id);
+		}
+	}
+}
+
+//copies both the key layout and elements of an existing table
+std::optional<uint64_t> instance::clone_table(uint64_t table_id) {
+	uint32_t element_count = table_entries[table_id].used_elems;
+	std::optional<uint64_t> res = allocate_table(element_count);
+	if (!res.has_value()) {
+		return std::nullopt;
+	}
+
+	//allocation may garbage collect or resize the table entries; fetch both entries afterwards
+	table_entry& src = table_entries[table_id];
+	table_entry& dest = table_entries[res.value()];
+	if (element_count > 0) {
+		move_table_contents(dest.block.table_start, src.block.table_start, element_count);
+	}
+	dest.used_elems = element_count;
+
+	//a copy that didn't fit in the nursery may reference young tables
+	if (!dest.young && !young_tables.empty()) {
+		remember_table(res.value(), dest);
+	}
+
+	//a copy made while marking is already black, so nothing it copied may stay white
+	if (collection_phase == GC_MARKING) {
+		for (uint_fast32_t i = 0; i < element_count; i++) {
+			shade(table_elems[dest.block.table_start + i]);
+			shade(table_keys[dest.block.table_start + i].key);
+		}
+	}
+
+	return res;
+}
+
 //elements are not initialized by default
 bool instance::reallocate_table(uint64_t table_id, uint32_t element_count) {
-	table_entry& entry = table_entries.unsafe_get(table_id);
+	table_entry& entry = table_entries[table_id];
 
 	if (element_count > entry.block.allocated_capacity) { //expand allocation
+		//young tables grow within the nursery while it has room; their old block is reclaimed with the rest of the nursery
+		if (entry.young && nursery_offset + element_count <= max_table && element_count < large_table_elems) {
+			move_table_contents(nursery_offset, entry.block.table_start, entry.used_elems);
+			entry.block = {
+				.table_start = nursery_offset,
+				.allocated_capacity = element_count
+			};
+			nursery_offset += element_count;
+			return true;
+		}
+		if (entry.block.table_start >= large_space_start && entry.block.table_start < frame_space_start && extend_large_block(entry.block, element_count)) {
+			return true;
+		}
+
 		std::optional<gc_block> alloc_res = allocate_block(element_count);
 		if (!alloc_res.has_value()) {
 			return false;
 		}
-		auto new_key_hashes = (std::pair<uint64_t, uint32_t>*)realloc(entry.key_hashes, element_count * sizeof(std::pair<uint64_t, uint32_t>));
-		if (new_key_hashes == NULL) {
-			return false;
-		}
-		entry.key_hashes = new_key_hashes;
-
 		gc_block alloced_entry = alloc_res.value();
-		std::memmove(&table_elems[alloced_entry.table_start], &table_elems[entry.block.table_start], entry.used_elems * sizeof(value));
+		move_table_contents(alloced_entry.table_start, entry.block.table_start, entry.used_elems);
 
-		if (entry.block.allocated_capacity > 0) {
-			free_tables.insert({ entry.block.allocated_capacity, entry.block });
-		}
+		release_block(entry.block);
 		entry.block = alloced_entry;
+
+		//a young table that outgrew the nursery is promoted in place, but its elements may still be young
+		if (entry.young) {
+			entry.young = false;
+			remember_table(table_id, entry);
+		}
 		return true;
 	}
 	else
@@ -106,181 +475,620 @@ bool instance::reallocate_table(uint64_t table_id, uint32_t element_count) {
 
 bool instance::reallocate_table(uint64_t table_id, uint32_t max_elem_extend, uint32_t min_elem_extend) {
 	for (uint32_t size = max_elem_extend; size >= min_elem_extend; size--) {
-		if (reallocate_table(table_id, table_entries.unsafe_get(table_id).block.allocated_capacity + size))
+		if (reallocate_table(table_id, table_entries[table_id].block.allocated_capacity + size))
 			return true;
 	}
 	return false;
 }
 
-void instance::garbage_collect(gc_collection_mode mode) {
 
+//moves elements along with their keys; the ranges may overlap
+void instance::move_table_contents(size_t dest_start, size_t src_start, uint32_t count) {
+	std::memmove(&table_elems[dest_start], &table_elems[src_start], count * sizeof(value));
+	std::memmove(&table_keys[dest_start], &table_keys[src_start], count * sizeof(table_key));
+}
 
-#define PUSH_TRACE(TO_TRACE) switch(TO_TRACE.type()) { case vtype::TABLE: tables_to_mark.push(TO_TRACE.table_id()); break;\
-														case vtype::STRING: marked_strs.insert(TO_TRACE.str()); break;\
-														case vtype::CLOSURE: { auto closure_info = TO_TRACE.closure();\
-														functions_to_mark.push(closure_info.first); tables_to_mark.push(closure_info.second); break; }\
-														case vtype::FOREIGN_RESOURCE: marked_foreign_resources.insert(static_cast<foreign_resource*>(TO_TRACE.raw_ptr())); }
+//returns a table's block to the free list
+void instance::release_block(gc_block block) {
+	if (block.table_start >= frame_space_start) {
+		return; //frame space is reclaimed when the frame returns
+	}
+	if (block.table_start >= large_space_start) {
+		release_large_block(block);
+		return;
+	}
+	if (block.table_start >= nursery_start) {
+		return; //nursery blocks are reclaimed all at once by minor collections
+	}
+	allocated_elems -= block.allocated_capacity;
+	if (block.allocated_capacity > 0) {
+		add_free_block(block);
+	}
+}
+
+void instance::shade(value val) {
+	switch (val.type())
+	{
+	case vtype::TABLE:
+		assert(table_entries.contains(val.table_id()));
+		if (table_marks.set(table_entries.slot_of(val.table_id()))) {
+			gray_tables.push_back(val.table_id());
+		}
+		break;
+	case vtype::STRING: {
+		string_header* str = val.str();
+		if (!str->marked) {
+			str->marked = true;
+			if (!str->is_flat()) {
+				gray_strs.push_back(str);
+			}
+		}
+		break;
+	}
+	case vtype::CLOSURE: {
+		auto closure_info = val.closure();
+		shade_function(closure_info.first);
+		shade(value(closure_info.second));
+		break;
+	}
+	case vtype::FOREIGN_RESOURCE:
+		assert(foreign_resources.contains(val.foreign_id()));
+		foreign_marks.set(foreign_resources.slot_of(val.foreign_id()));
+		break;
+	}
+}
+
+void instance::shade_function(uint32_t function_id) {
+	assert(function_entries.contains(function_id));
+	if (function_marks.set(function_entries.slot_of(function_id))) {
+		gray_functions.push_back(function_id);
+	}
+}
+
+//instances look up methods through their class, so its method table must stay alive too
+void instance::shade_class(uint32_t class_id) {
+	if (!class_marks.set(class_entries.slot_of(class_id))) {
+		return;
+	}
+
+	for (auto& method : class_entries[class_id].methods) {
+		shade(method.first);
+		shade_function(method.second);
+	}
+}
+
+//locals and globals are only scanned here; the write barrier shades anything stored into them afterwards
+void instance::gc_begin_cycle() {
+	assert(collection_phase == GC_IDLE);
+	collection_phase = GC_MARKING;
 
-	std::queue<uint64_t> tables_to_mark;
-	std::set<char*> marked_strs;
-	std::set<foreign_resource*> marked_foreign_resources;
-	std::queue<uint32_t> functions_to_mark;
+	function_marks.clear();
+	class_marks.clear();
 
 	for (uint_fast32_t i = 0; i < local_offset + extended_local_offset; i++)
-		PUSH_TRACE(local_elems[i]);
+		shade(local_elems[i]);
 	for (uint_fast32_t i = 0; i < global_offset; i++)
-		PUSH_TRACE(global_elems[i]);
+		shade(global_elems[i]);
+}
+
+//scans gray objects until roughly budget values have been visited; returns whether marking ran out of gray objects
+bool instance::gc_mark_step(size_t budget) {
+	size_t work = 0;
+	while (work < budget) {
+		if (!gray_strs.empty()) {
+			string_header* str = gray_strs.back();
+			gray_strs.pop_back();
+
+			if (!str->is_flat()) { //may have been flattened since it was shaded
+				shade(value(str->rope()->left));
+				shade(value(str->rope()->right));
+			}
+			work++;
+		}
+		else if (!gray_tables.empty()) {
+			uint64_t id = gray_tables.back();
+			gray_tables.pop_back();
+			table_entry& entry = table_entries[id];
+
+			//the next table's elements load while this one is scanned
+			if (!gray_tables.empty()) {
+				prefetch(&table_elems[table_entries[gray_tables.back()].block.table_start]);
+			}
+
+			for (uint_fast32_t i = 0; i < entry.used_elems; i++) {
+				shade(table_elems[i + entry.block.table_start]);
+				shade(table_keys[i + entry.block.table_start].key);
+			}
+			if (entry.class_id.has_value()) {
+				shade_class(entry.class_id.value());
+			}
+			work += 1 + entry.used_elems;
+		}
+		else if (!gray_functions.empty()) {
+			uint32_t id = gray_functions.back();
+			gray_functions.pop_back();
+			loaded_function_entry& entry = function_entries[id];
+
+			for (string_header* refed_str : entry.referenced_const_strs) {
+				shade(value(refed_str));
+			}
+			for (uint32_t refed_function : entry.referenced_func_ids) {
+				shade_function(refed_function);
+			}
+			for (uint32_t refed_class : entry.referenced_class_ids) {
+				shade_class(refed_class);
+			}
+			work += 1 + entry.referenced_const_strs.size() + entry.referenced_func_ids.size() + entry.referenced_class_ids.size();
+		}
+		else {
+			return true;
+		}
+	}
+	return gray_strs.empty() && gray_tables.empty() && gray_functions.empty();
+}
+
+//traces the table graph on several threads, each with its own gray stack that idle threads steal from
+//only tables are numerous enough to be worth splitting; any other objects the threads find are shaded on this thread afterwards, and since none of them reference tables, gc_mark_step finishes them off
+void instance::gc_parallel_mark() {
+	struct mark_worker {
+		std::mutex lock;
+		std::deque<uint64_t> gray;
+		std::vector<value> deferred;
+		std::vector<uint32_t> deferred_classes;
+	};
+
+	std::vector<mark_worker> workers(gc_mark_threads);
+	for (size_t i = 0; i < gray_tables.size(); i++) {
+		workers[i % workers.size()].gray.push_back(gray_tables[i]);
+	}
+	std::atomic<size_t> pending = gray_tables.size(); //tables shaded but not yet scanned; marking is done once none are left
+	gray_tables.clear();
+	table_marks.reserve(table_entries.slot_count());
+
+	auto mark = [this, &workers, &pending](size_t self) {
+		mark_worker& worker = workers[self];
+		auto shade_child = [this, &worker, &pending](value val) {
+			uint64_t table_id;
+			switch (val.type())
+			{
+			case vtype::TABLE:
+				table_id = val.table_id();
+				break;
+			case vtype::CLOSURE:
+				worker.deferred.push_back(val); //for its function; the capture table is marked below
+				table_id = val.closure().second;
+				break;
+			case vtype::STRING:
+			case vtype::FOREIGN_RESOURCE:
+				worker.deferred.push_back(val);
+				return;
+			default:
+				return;
+			}
+
+			assert(table_entries.contains(table_id));
+			if (table_marks.set_atomic(table_entries.slot_of(table_id))) {
+				pending++;
+				std::lock_guard<std::mutex> guard(worker.lock);
+				worker.gray.push_back(table_id);
+			}
+		};
+
+		for (;;) {
+			std::optional<uint64_t> id;
+			{
+				std::lock_guard<std::mutex> guard(worker.lock);
+				if (!worker.gray.empty()) {
+					id = worker.gray.back();
+					worker.gray.pop_back();
+				}
+			}
+			for (size_t i = 1; !id.has_value() && i < workers.size(); i++) {
+				mark_worker& victim = workers[(self + i) % workers.size()];
+				std::lock_guard<std::mutex> guard(victim.lock);
+				if (!victim.gray.empty()) {
+					id = victim.gray.front(); //steal the oldest, which tends to have the most left beneath it
+					victim.gray.pop_front();
+				}
+			}
+			if (!id.has_value()) {
+				if (pending == 0) {
+					return;
+				}
+				std::this_thread::yield();
+				continue;
+			}
+
+			const table_entry& entry = table_entries[id.value()];
+			for (uint_fast32_t i = 0; i < entry.used_elems; i++) {
+				shade_child(table_elems[i + entry.block.table_start]);
+				shade_child(table_keys[i + entry.block.table_start].key);
+			}
+			if (entry.class_id.has_value()) {
+				worker.deferred_classes.push_back(entry.class_id.value());
+			}
+			pending--; //only after its children were counted
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (size_t i = 1; i < workers.size(); i++) {
+		threads.emplace_back(mark, i);
+	}
+	mark(0);
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+
+	for (mark_worker& worker : workers) {
+		for (value val : worker.deferred) {
+			shade(val);
+		}
+		for (uint32_t class_id : worker.deferred_classes) {
+			shade_class(class_id);
+		}
+	}
+}
+
+//the atomic end of marking: rescans the stacks, which have no write barrier, finishes marking, and releases unreachable foreign resources
+void instance::gc_finish_marking(gc_collection_mode mode) {
+	assert(collection_phase == GC_MARKING);
 
 	if (mode == gc_collection_mode::STANDARD) {
 		for (value eval_value : evaluation_stack)
-			PUSH_TRACE(eval_value);
+			shade(eval_value);
 		for (value scratch_value : scratchpad_stack)
-			PUSH_TRACE(scratch_value);
+			shade(scratch_value);
 	}
 	else {
 		scratchpad_stack.clear();
 		if (mode == gc_collection_mode::FINALIZE_COLLECT_RETURN) {
-			PUSH_TRACE(evaluation_stack.back());
+			for (value eval_value : evaluation_stack) //the return value, and whatever an enclosing execution still has on the stack
+				shade(eval_value);
 		}
 		else {
+			release_frame_tables(0);
 			evaluation_stack.clear();
 			return_stack.clear();
 			extended_offsets.clear();
 		}
 	}
 
-#undef PUSH_TRACE
-
-	//mark all used tables
-	std::set<uint64_t> marked_tables;
-
-	while (!tables_to_mark.empty())
-	{
-		uint64_t id = tables_to_mark.front();
-		tables_to_mark.pop();
-		table_entry& entry = table_entries.unsafe_get(id);
+	//top level code is discarded once it finishes executing; until then the strings it loads must be kept
+	if (mode >= gc_collection_mode::FINALIZE_COLLECT_ERROR && exec_depth == 0) {
+		toplevel_const_strs.clear();
+	}
+	else {
+		for (string_header* str : toplevel_const_strs)
+			shade(value(str));
+	}
 
-		marked_tables.emplace(id);
+	if (gc_mark_threads > 1 && allocated_elems >= parallel_mark_min_elems && !gray_tables.empty()) {
+		gc_parallel_mark();
+	}
+	gc_mark_step(SIZE_MAX);
 
-		for (uint_fast32_t i = 0; i < entry.used_elems; i++) {
-			value val = table_elems[i + entry.block.table_start];
-			switch (val.type())
-			{
-			case vtype::TABLE:
-				if (!marked_tables.contains(val.table_id())) {
-					tables_to_mark.push(val.table_id());
-				}
-				break;
-			case vtype::STRING:
-				marked_strs.insert(val.str());
-				break;
-			case vtype::CLOSURE:
-			{
-				auto closure_info = val.closure();
-				functions_to_mark.push(closure_info.first);
-				if (!marked_tables.contains(closure_info.second)) {
-					tables_to_mark.push(closure_info.second);
-				}
-				break;
-			}
-			case vtype::FOREIGN_RESOURCE:
-				marked_foreign_resources.insert(static_cast<foreign_resource*>(val.raw_ptr()));
-				break;
-			}
+	for (uint32_t slot = 0; slot < foreign_resources.slot_count(); slot++) {
+		std::optional<uint32_t> id = foreign_resources.id_at(slot);
+		if (id.has_value() && !foreign_marks.test(slot)) {
+			foreign_resources[id.value()]->unref();
+			foreign_resources.remove(id.value());
 		}
 	}
+	foreign_marks.clear();
 
-	auto cmp_function_by_start = [this](uint32_t a, uint32_t b) -> bool {
-		return function_entries.unsafe_get(a).start_address < function_entries.unsafe_get(b).start_address;
-	};
+	collection_phase = GC_SWEEPING;
+	table_sweep_cursor = 0;
+	str_sweep_cursor = 0;
+}
 
-	std::set<uint32_t, decltype(cmp_function_by_start)> marked_functions(cmp_function_by_start);
-	while (!functions_to_mark.empty()) {
-		uint32_t id = functions_to_mark.front();
-		functions_to_mark.pop();
+//frees up to budget unmarked tables and strings, and clears the marks of survivors for the next cycle; returns whether sweeping finished
+bool instance::gc_sweep_step(size_t budget) {
+	assert(collection_phase == GC_SWEEPING);
 
-		if (marked_functions.contains(id)) {
+	size_t work = 0;
+	for (; table_sweep_cursor < table_entries.slot_count() && work < budget; table_sweep_cursor++, work++) {
+		std::optional<uint64_t> id = table_entries.id_at(table_sweep_cursor);
+		if (!id.has_value()) {
 			continue;
 		}
-		marked_functions.insert(id);
-		for (char* refed_str : function_entries.unsafe_get(id).referenced_const_strs) {
-			marked_strs.insert(refed_str);
+
+		if (table_marks.test(table_sweep_cursor)) {
+			table_marks.reset(table_sweep_cursor);
 		}
-		for (uint32_t refed_function : function_entries.unsafe_get(id).referenced_func_ids) {
-			functions_to_mark.push(refed_function);
+		else {
+			release_block(table_entries[id.value()].block);
+			table_entries.remove(id.value());
 		}
 	}
 
-	//sweep unreachable tables
-	for (auto it = table_entries.ne_cbegin(); it != table_entries.ne_cend();) {
-		size_t pos = table_entries.get_pos(it);
-		if (!marked_tables.contains(pos)) {
-			available_table_ids.push_back(pos);
+	for (; str_sweep_cursor < active_strs.size() && work < budget; work++) {
+		string_header* str = active_strs[str_sweep_cursor];
+		if (str->marked) {
+			str->marked = false;
+			str_sweep_cursor++;
+			continue;
+		}
 
-			free(it->key_hashes);
-			it = table_entries.erase(it);
+		if (str->interned) {
+			auto it = interned_strs.find(std::string_view(str->chars(), str->length));
+			assert(it != interned_strs.end());
+			constants.remove(it->second);
+			interned_strs.erase(it);
 		}
-		else {
-			it++;
+		free_string(str);
+		active_strs[str_sweep_cursor] = active_strs.back();
+		active_strs.pop_back();
+	}
+
+	if (table_sweep_cursor < table_entries.slot_count() || str_sweep_cursor < active_strs.size()) {
+		return false;
+	}
+
+	collection_phase = GC_IDLE;
+	collection_policy.collected(allocated_elems + large_elems, active_str_bytes, max_table);
+	trim_table_heap();
+	return true;
+}
+
+//copies a young table, or a closure's young capture table, into the old generation; returns false if the old generation is full
+bool instance::gc_promote(value val) {
+	uint64_t id;
+	if (val.type() == vtype::TABLE) {
+		id = val.table_id();
+	}
+	else if (val.type() == vtype::CLOSURE) {
+		id = val.closure().second;
+	}
+	else {
+		return true;
+	}
+
+	table_entry& entry = table_entries[id];
+	if (!entry.young) {
+		return true;
+	}
+
+	std::optional<gc_block> res = allocate_promoted_block(entry.block.allocated_capacity);
+	if (!res.has_value()) {
+		return false;
+	}
+	move_table_contents(res.value().table_start, entry.block.table_start, entry.used_elems);
+	entry.block = res.value();
+	entry.young = false;
+	gray_tables.push_back(id); //its elements are scanned for young tables in turn
+	return true;
+}
+
+//promotes the young tables reachable from the roots and the remembered set, then empties the nursery
+//ids are indirect, so promoted tables only need their blocks moved; nothing referencing them is rewritten
+void instance::gc_minor_collect() {
+	if (young_tables.empty()) {
+		return;
+	}
+	assert(collection_phase == GC_IDLE);
+
+	bool promoted = true;
+	for (uint_fast32_t i = 0; promoted && i < local_offset + extended_local_offset; i++)
+		promoted = gc_promote(local_elems[i]);
+	for (uint_fast32_t i = 0; promoted && i < global_offset; i++)
+		promoted = gc_promote(global_elems[i]);
+	for (auto it = evaluation_stack.begin(); promoted && it != evaluation_stack.end(); it++)
+		promoted = gc_promote(*it);
+	for (auto it = scratchpad_stack.begin(); promoted && it != scratchpad_stack.end(); it++)
+		promoted = gc_promote(*it);
+	for (auto it = remembered_tables.begin(); promoted && it != remembered_tables.end(); it++)
+		gray_tables.push_back(*it);
+
+	while (promoted && !gray_tables.empty()) {
+		uint64_t id = gray_tables.back();
+		gray_tables.pop_back();
+		table_entry& entry = table_entries[id];
+
+		for (uint_fast32_t i = 0; promoted && i < entry.used_elems; i++) {
+			promoted = gc_promote(table_elems[i + entry.block.table_start]) && gc_promote(table_keys[i + entry.block.table_start].key);
 		}
 	}
 
-	//free unreachable strings
-	for (auto it = active_strs.begin(); it != active_strs.end();)
-	{
-		if (!marked_strs.contains(*it)) {
-			uint64_t hash = hash_combine(str_hash(*it), vtype::STRING);
-			auto it2 = added_constant_hashes.find(hash);
-			if (it2 != added_constant_hashes.end()) {
-				available_constant_ids.push_back(it2->second);
-				added_constant_hashes.erase(hash);
-			}
-			free(*it);
-			it = active_strs.erase(it);
+	if (!promoted) {
+		//the survivors don't fit in the old generation; a full collection frees or compacts enough room
+		gray_tables.clear();
+		garbage_collect(gc_collection_mode::STANDARD);
+		return;
+	}
+
+	for (uint64_t id : young_tables) {
+		if (table_entries.contains(id) && table_entries[id].young) { //frame tables that fell back to the nursery may already be freed
+			table_entries.remove(id);
 		}
-		else {
-			it++;
+	}
+	young_tables.clear();
+	for (uint64_t id : remembered_tables) {
+		table_entries[id].remembered = false;
+	}
+	remembered_tables.clear();
+	nursery_offset = nursery_start;
+}
+
+//called once a full collection has moved every live table, young ones included, into the old generation
+void instance::gc_reset_generations() {
+	for (uint64_t id : young_tables) {
+		if (table_entries.contains(id)) {
+			table_entries[id].young = false;
+		}
+	}
+	young_tables.clear();
+	for (uint64_t id : remembered_tables) {
+		if (table_entries.contains(id)) {
+			table_entries[id].remembered = false;
+		}
+	}
+	remembered_tables.clear();
+
+	nursery_start = std::max(table_offset, max_table - std::min(nursery_capacity, max_table));
+	if (!table_elem_memory.commit_range(nursery_start * sizeof(value), (max_table - nursery_start) * sizeof(value)) ||
+		!table_key_memory.commit_range(nursery_start * sizeof(table_key), (max_table - nursery_start) * sizeof(table_key))) {
+		nursery_start = max_table; //no memory for a nursery; tables are allocated in the old generation
+	}
+	nursery_offset = nursery_start;
+}
+
+void instance::set_generational_gc(std::optional<uint32_t> nursery_elems) {
+	gc_minor_collect();
+	nursery_capacity = nursery_elems.value_or(0);
+	gc_reset_generations();
+}
+
+//advances an incremental collection by one step, starting a cycle once enough has been allocated since the last one
+void instance::gc_allocation_step() {
+	if (!gc_step_budget.has_value()) {
+		return;
+	}
+
+	if (collection_phase == GC_IDLE) {
+		if (!collection_policy.collection_due()) {
+			return;
+		}
+
+		//the nursery is emptied first, so that no young tables exist while a cycle is underway
+		gc_minor_collect();
+		if (!collection_policy.collection_due()) {
+			return;
+		}
+		gc_begin_cycle();
+	}
+
+	if (collection_phase == GC_MARKING) {
+		if (gc_mark_step(gc_step_budget.value())) {
+			gc_finish_marking(gc_collection_mode::STANDARD);
 		}
 	}
+	else {
+		gc_sweep_step(gc_step_budget.value());
+	}
+}
+
+//merges adjacent free blocks, and hands free space at the top of the old generation back to the bump allocator; returns the size of the largest free block
+uint32_t instance::coalesce_free_blocks() {
+	std::vector<gc_block> blocks;
+	for (std::vector<gc_block>& free_list : free_blocks) {
+		blocks.insert(blocks.end(), free_list.begin(), free_list.end());
+		free_list.clear();
+	}
+	free_block_classes = 0;
+	std::ranges::sort(blocks, [](const gc_block& a, const gc_block& b) -> bool {
+		return a.table_start < b.table_start;
+	});
 
-	//release unreachable foreign resources
-	for (auto it = foreign_resources.begin(); it != foreign_resources.end();) {
-		foreign_resource* resource = *it;
-		if (!marked_foreign_resources.contains(resource)) {
-			resource->unref();
-			it = foreign_resources.erase(it);
+	std::vector<gc_block> merged;
+	for (const gc_block& block : blocks) {
+		if (!merged.empty() && merged.back().table_start + merged.back().allocated_capacity == block.table_start && merged.back().allocated_capacity <= UINT32_MAX - block.allocated_capacity) {
+			merged.back().allocated_capacity += block.allocated_capacity;
 		}
 		else {
-			it++;
+			merged.push_back(block);
 		}
 	}
+	if (!merged.empty() && merged.back().table_start + merged.back().allocated_capacity == table_offset) {
+		table_offset = merged.back().table_start;
+		merged.pop_back();
+	}
 
-	//compact used tables
+	uint32_t largest = 0;
+	for (const gc_block& block : merged) {
+		add_free_block(block);
+		largest = std::max(largest, block.allocated_capacity);
+	}
+	return largest;
+}
 
+//moves every live table, young ones included, to the bottom of table memory, leaving no free blocks; large tables are left in place
+void instance::compact_tables() {
 	//sort table ids by table start address
-	std::vector<uint64_t> sorted_marked(marked_tables.begin(), marked_tables.end());
-	std::ranges::sort(sorted_marked, [this](uint64_t a, uint64_t b) -> bool {
-		return table_entries.unsafe_get(a).block.table_start < table_entries.unsafe_get(b).block.table_start;
+	std::vector<uint64_t> sorted_live;
+	for (uint32_t slot = 0; slot < table_entries.slot_count(); slot++) {
+		std::optional<uint64_t> id = table_entries.id_at(slot);
+		if (id.has_value()) {
+			sorted_live.push_back(id.value());
+		}
+	}
+	std::ranges::sort(sorted_live, [this](uint64_t a, uint64_t b) -> bool {
+		return table_entries[a].block.table_start < table_entries[b].block.table_start;
 	});
 	size_t new_table_offset = 0;
-	for (uint64_t id : sorted_marked) {
-		instance::table_entry& entry = table_entries.unsafe_get(id);
+	for (uint64_t id : sorted_live) {
+		instance::table_entry& entry = table_entries[id];
+		if (entry.block.table_start >= large_space_start) {
+			break; //large tables sort last, and stay where they are
+		}
 
 		if (entry.block.table_start == new_table_offset) {
 			new_table_offset += entry.block.allocated_capacity;
 			continue;
 		}
 
-		std::memmove(&table_elems[new_table_offset], &table_elems[entry.block.table_start], entry.used_elems * sizeof(value));
+		move_table_contents(new_table_offset, entry.block.table_start, entry.used_elems);
 
 		entry.block.table_start = new_table_offset;
 		new_table_offset += entry.block.allocated_capacity;
 	}
 	table_offset = new_table_offset;
-	free_tables.clear();
-	available_table_ids.shrink_to_fit();
-	available_constant_ids.shrink_to_fit();
-	available_function_ids.shrink_to_fit();
+	allocated_elems = table_offset;
+	for (std::vector<gc_block>& free_list : free_blocks) {
+		free_list.clear();
+	}
+	free_block_classes = 0;
+}
+
+//a full collection: completes any incremental cycle underway in one go, and compacts table memory once it gets fragmented
+void instance::garbage_collect(gc_collection_mode mode) {
+	if (collection_phase == GC_SWEEPING) {
+		gc_sweep_step(SIZE_MAX);
+	}
+	else if (collection_phase == GC_MARKING) {
+		//restart rather than finish; everything allocated since the cycle began is black, and a full collection must be able to reclaim it
+		table_marks.clear();
+		for (string_header* str : active_strs) {
+			str->marked = false;
+		}
+		gray_tables.clear();
+		gray_strs.clear();
+		gray_functions.clear();
+		foreign_marks.clear();
+		collection_phase = GC_IDLE;
+	}
+	if (collection_phase == GC_IDLE) {
+		gc_begin_cycle();
+	}
+	gc_finish_marking(mode);
+	gc_sweep_step(SIZE_MAX);
+
+	//surviving young tables move into the old generation's free space, unless it's fragmented enough to compact anyway
+	uint32_t largest_free_block = coalesce_free_blocks();
+	bool compact = collection_policy.should_compact(table_offset - allocated_elems - largest_free_block, table_offset);
+	for (auto it = young_tables.begin(); !compact && it != young_tables.end(); it++) {
+		if (!table_entries.contains(*it) || !table_entries[*it].young) {
+			continue;
+		}
+
+		table_entry& entry = table_entries[*it];
+		std::optional<gc_block> res = allocate_promoted_block(entry.block.allocated_capacity);
+		if (!res.has_value()) {
+			compact = true;
+			break;
+		}
+		move_table_contents(res.value().table_start, entry.block.table_start, entry.used_elems);
+		entry.block = res.value();
+		entry.young = false;
+	}
+	if (compact) {
+		compact_tables();
+	}
+	gc_reset_generations();
+
+	table_entries.shrink_to_fit();
+	constants.shrink_to_fit();
+	function_entries.shrink_to_fit();
 
 	evaluation_stack.shrink_to_fit();
 	scratchpad_stack.shrink_to_fit();
@@ -288,51 +1096,166 @@ void instance::garbage_collect(gc_collection_mode mode) {
 	extended_offsets.shrink_to_fit();
 
 	if (mode >= gc_collection_mode::FINALIZE_COLLECT_ERROR && exec_depth == 0) {
-		//remove unreachable functions
-		for (auto it = function_entries.ne_cbegin(); it != function_entries.ne_cend(); it++) {
-			size_t pos = function_entries.get_pos(it);
-			if (!marked_functions.contains(pos)) {
-				available_function_ids.push_back(pos);
-				it = function_entries.erase(it);
+		//top level code is always loaded last, so dropping it first keeps holes from reaching the end of the code space
+		for (auto it = ip_src_locs.lower_bound(top_level_code_start); it != ip_src_locs.end();) {
+			it = ip_src_locs.erase(it);
+		}
+		loaded_instructions.erase(loaded_instructions.begin() + top_level_code_start, loaded_instructions.end());
+		release_method_call_sites(toplevel_call_sites);
+
+		//remove unreachable functions; function marks are left as they were after marking
+		std::vector<uint32_t> marked_functions;
+		bool freed_code = false;
+		for (uint32_t slot = 0; slot < function_entries.slot_count(); slot++) {
+			std::optional<uint32_t> id = function_entries.id_at(slot);
+			if (!id.has_value()) {
+				continue;
+			}
+			if (function_marks.test(slot)) {
+				marked_functions.push_back(id.value());
 			}
 			else {
-				it++;
+				loaded_function_entry& entry = function_entries[id.value()];
+				release_code(entry.start_address - 1, entry.length + 1); //includes the function instruction
+				release_method_call_sites(entry.method_call_sites);
+				function_entries.remove(id.value());
+				freed_code = true;
 			}
 		}
 
-		//compact instructions of used functions only
-		uint32_t current_ip = 0;
-		std::vector<std::pair<uint32_t, source_loc>> to_reinsert;
-		for (uint32_t id : marked_functions) {
-			instance::loaded_function_entry& entry = function_entries.unsafe_get(id);
-
-			if (entry.start_address == current_ip) {
-				current_ip += entry.length;
-				continue;
+		//classes without instances go with their constructor
+		for (uint32_t slot = 0; slot < class_entries.slot_count(); slot++) {
+			std::optional<uint32_t> id = class_entries.id_at(slot);
+			if (id.has_value() && !class_marks.test(slot)) {
+				class_entries.remove(id.value());
+				freed_code = true;
 			}
+		}
+		if (freed_code) {
+			forget_cached_methods();
+		}
 
-			uint32_t offset = entry.start_address - current_ip;
-			for (auto it = ip_src_locs.lower_bound(entry.start_address); it != ip_src_locs.lower_bound(entry.start_address + entry.length);) {
-				to_reinsert.push_back(std::make_pair(it->first - offset, it->second));
-				it = ip_src_locs.erase(it);
+		//free number constants that no remaining function loads
+		constant_marks.clear();
+		for (uint32_t id : marked_functions) {
+			for (uint32_t constant_id : function_entries[id].referenced_const_nums) {
+				constant_marks.set(constants.slot_of(constant_id));
+			}
+		}
+		for (uint32_t slot = 0; slot < constants.slot_count(); slot++) {
+			std::optional<uint32_t> id = constants.id_at(slot);
+			if (id.has_value() && constants[id.value()].type() == vtype::NUMBER && !constant_marks.test(slot)) {
+				auto it = added_constant_hashes.find(constants[id.value()].compute_hash());
+				if (it != added_constant_hashes.end() && it->second == id.value()) {
+					added_constant_hashes.erase(it);
+				}
+				constants.remove(id.value());
 			}
+		}
 
-			auto start_it = loaded_instructions.begin() + entry.start_address;
-			std::move(start_it, start_it + entry.length, loaded_instructions.begin() + current_ip);
+		loaded_instructions.shrink_to_fit();
+		current_ip = static_cast<uint32_t>(loaded_instructions.size());
+		top_level_code_start = current_ip;
+	}
+}
 
-			entry.start_address = current_ip;
-			current_ip += entry.length;
+//places a function's code in the smallest hole that fits, or appends it
+uint32_t instance::allocate_code(const std::vector<instruction>& code) {
+	uint32_t length = static_cast<uint32_t>(code.size());
+	auto best = free_code_segments.end();
+	for (auto it = free_code_segments.begin(); it != free_code_segments.end(); it++) {
+		if (it->second >= length && (best == free_code_segments.end() || it->second < best->second)) {
+			best = it;
 		}
-		for (auto it = ip_src_locs.lower_bound(current_ip); it != ip_src_locs.end();) {
-			it = ip_src_locs.erase(it);
+	}
+
+	if (best == free_code_segments.end()) {
+		uint32_t start_address = static_cast<uint32_t>(loaded_instructions.size());
+		loaded_instructions.insert(loaded_instructions.end(), code.begin(), code.end());
+		return start_address;
+	}
+
+	uint32_t start_address = best->first;
+	uint32_t remaining = best->second - length;
+	free_code_segments.erase(best);
+	if (remaining > 0) {
+		free_code_segments.insert({ start_address + length, remaining });
+	}
+	std::copy(code.begin(), code.end(), loaded_instructions.begin() + start_address);
+	return start_address;
+}
+
+//frees a dead function's code in place; neighbouring holes are merged, and a hole at the end of the code space is truncated
+void instance::release_code(uint32_t start_address, uint32_t length) {
+	for (auto it = ip_src_locs.lower_bound(start_address); it != ip_src_locs.end() && it->first < start_address + length;) {
+		it = ip_src_locs.erase(it);
+	}
+
+	auto next = free_code_segments.lower_bound(start_address);
+	if (next != free_code_segments.end() && next->first == start_address + length) {
+		length += next->second;
+		next = free_code_segments.erase(next);
+	}
+	if (next != free_code_segments.begin()) {
+		auto prev = std::prev(next);
+		if (prev->first + prev->second == start_address) {
+			start_address = prev->first;
+			length += prev->second;
+			free_code_segments.erase(prev);
 		}
-		for (auto new_ip_src_loc : to_reinsert) {
-			ip_src_locs.insert(new_ip_src_loc);
+	}
+
+	if (start_address + length >= loaded_instructions.size()) {
+		if (start_address < loaded_instructions.size()) {
+			loaded_instructions.erase(loaded_instructions.begin() + start_address, loaded_instructions.end());
 		}
+	}
+	else {
+		free_code_segments.insert({ start_address, length });
+	}
+}
 
-		loaded_instructions.erase(loaded_instructions.begin() + current_ip, loaded_instructions.end());
-		loaded_instructions.shrink_to_fit();
+//called whenever execute returns; a host calling back into scripts often would otherwise pay for a full collection on every call
+//unless allocation has made a collection due, this only clears what the execution left behind
+void instance::finalize_execution(gc_collection_mode mode) {
+	if (mode == gc_collection_mode::FINALIZE_COLLECT_ERROR && exec_depth == 0) {
+		//the failed frames' locals aren't roots anymore; they may hold frame tables that are about to be released
+		local_offset = 0;
+		extended_local_offset = top_level_local_offset;
+	}
+	if (evaluation_region && exec_depth == 0 && collection_phase == GC_IDLE) {
+		if (mode == gc_collection_mode::FINALIZE_COLLECT_ERROR) {
+			//nothing the failed evaluation left on the stacks survives it
+			release_frame_tables(0);
+			evaluation_stack.clear();
+			scratchpad_stack.clear();
+		}
+		gc_minor_collect();
+	}
+	if (!gc_step_budget.has_value() && collection_policy.collection_due()) {
+		garbage_collect(mode);
+		return;
+	}
 
-		this->current_ip = static_cast<uint32_t>(loaded_instructions.size());
+	scratchpad_stack.clear();
+	if (mode == gc_collection_mode::FINALIZE_COLLECT_ERROR) {
+		release_frame_tables(0);
+		evaluation_stack.clear();
+		return_stack.clear();
+		extended_offsets.clear();
 	}
-}
\ No newline at end of file
+
+	if (exec_depth == 0) {
+		//top level code and the strings only it loaded are left to the next collection
+		for (auto it = ip_src_locs.lower_bound(top_level_code_start); it != ip_src_locs.end();) {
+			it = ip_src_locs.erase(it);
+		}
+		loaded_instructions.erase(loaded_instructions.begin() + top_level_code_start, loaded_instructions.end());
+		toplevel_const_strs.clear();
+		release_method_call_sites(toplevel_call_sites);
+		current_ip = static_cast<uint32_t>(loaded_instructions.size());
+	}
+
+	//an incremental collector only takes a step; debt isn't paid off until a cycle finishes, so a full collection here would preempt every cycle underway
+	gc_allocation_step();
+}
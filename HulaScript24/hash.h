@@ -1,6 +1,12 @@
 #pragma once
 
 #include <cstdint>
+#include <cstring>
+#include <string_view>
+
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#endif
 
 namespace HulaScript {
     //dj2b str hash
@@ -15,4 +21,102 @@ namespace HulaScript {
         lhs ^= rhs + 0x9e3779b9 + (lhs << 6) + (lhs >> 2);
         return lhs;
     }
-}
\ No newline at end of file
+
+    namespace wyhash_detail {
+        static inline void mum(uint64_t* a, uint64_t* b) {
+#if defined(__SIZEOF_INT128__)
+            __uint128_t r = *a;
+            r *= *b;
+            *a = static_cast<uint64_t>(r);
+            *b = static_cast<uint64_t>(r >> 64);
+#elif defined(_MSC_VER) && defined(_M_X64)
+            *a = _umul128(*a, *b, b);
+#else
+            uint64_t ha = *a >> 32, hb = *b >> 32, la = static_cast<uint32_t>(*a), lb = static_cast<uint32_t>(*b);
+            uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb, t = rl + (rm0 << 32);
+            uint64_t c = t < rl;
+            uint64_t lo = t + (rm1 << 32);
+            c += lo < t;
+            *a = lo;
+            *b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+        }
+
+        static inline uint64_t mix(uint64_t a, uint64_t b) {
+            mum(&a, &b);
+            return a ^ b;
+        }
+
+        static inline uint64_t read8(const uint8_t* p) {
+            uint64_t v;
+            std::memcpy(&v, p, 8);
+            return v;
+        }
+
+        static inline uint64_t read4(const uint8_t* p) {
+            uint32_t v;
+            std::memcpy(&v, p, 4);
+            return v;
+        }
+
+        static inline uint64_t read3(const uint8_t* p, size_t k) {
+            return (static_cast<uint64_t>(p[0]) << 16) | (static_cast<uint64_t>(p[k >> 1]) << 8) | p[k - 1];
+        }
+    }
+
+    //hash for runtime string keys; adapted from wyhash (public domain)
+    //consumes 8 to 48 bytes per step instead of dj2b's one, and isn't recursive, so it's suitable for long strings
+    static inline uint64_t key_str_hash(const char* str, size_t length) {
+        using namespace wyhash_detail;
+        static const uint64_t secret[4] = { 0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull, 0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull };
+
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(str);
+        uint64_t seed = mix(secret[0], secret[1]);
+        uint64_t a, b;
+        if (length <= 16) {
+            if (length >= 4) {
+                a = (read4(p) << 32) | read4(p + ((length >> 3) << 2));
+                b = (read4(p + length - 4) << 32) | read4(p + length - 4 - ((length >> 3) << 2));
+            }
+            else if (length > 0) {
+                a = read3(p, length);
+                b = 0;
+            }
+            else {
+                a = b = 0;
+            }
+        }
+        else {
+            size_t i = length;
+            if (i > 48) {
+                uint64_t see1 = seed, see2 = seed;
+                do {
+                    seed = mix(read8(p) ^ secret[1], read8(p + 8) ^ seed);
+                    see1 = mix(read8(p + 16) ^ secret[2], read8(p + 24) ^ see1);
+                    see2 = mix(read8(p + 32) ^ secret[3], read8(p + 40) ^ see2);
+                    p += 48;
+                    i -= 48;
+                } while (i > 48);
+                seed ^= see1 ^ see2;
+            }
+            while (i > 16) {
+                seed = mix(read8(p) ^ secret[1], read8(p + 8) ^ seed);
+                i -= 16;
+                p += 16;
+            }
+            a = read8(p + i - 16);
+            b = read8(p + i - 8);
+        }
+
+        a ^= secret[1];
+        b ^= seed;
+        mum(&a, &b);
+        return mix(a ^ secret[0] ^ length, b ^ secret[1]);
+    }
+
+    struct key_str_hasher {
+        size_t operator()(std::string_view str) const {
+            return static_cast<size_t>(key_str_hash(str.data(), str.size()));
+        }
+    };
+}
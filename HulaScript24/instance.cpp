@@ -1,37 +1,213 @@
 #include <cstdlib>
 #include <cassert>
 #include <sstream>
+#include <cstring>
 #include "hash.h"
 #include "instance.h"
 
 using namespace HulaScript::Runtime;
 
-instance::instance(uint32_t max_locals, uint32_t max_globals, size_t max_table) : 
-	max_locals(max_locals), max_globals(max_globals), max_table(max_table),
-	local_offset(0), extended_local_offset(0), global_offset(0), table_offset(0), current_ip(0), top_level_local_offset(0), exec_depth(0),
-	local_elems((value*)malloc(max_locals * sizeof(value))),
-	global_elems((value*)malloc(max_globals * sizeof(value))),
-	table_elems((value*)malloc(max_table * sizeof(value))),
-	table_entries(NULL)
+instance::instance(uint32_t max_locals, uint32_t max_globals, size_t max_table, allocator& str_allocator) : 
+	max_locals(max_locals), max_globals(max_globals), max_table(max_table), str_allocator(str_allocator),
+	local_offset(0), extended_local_offset(0), global_offset(0), table_offset(0), current_ip(0), top_level_local_offset(0), exec_depth(0), top_level_code_start(0),
+	active_str_bytes(0), collection_policy(2, std::min(max_table, min_table_soft_limit) / 4, min_str_collect_debt), table_soft_limit(0),
+	large_space_start(round_to_large_granularity(max_table)), large_space_end(2 * round_to_large_granularity(max_table)),
+	frame_space_start(2 * round_to_large_granularity(max_table)), frame_space_end(frame_space_start + frame_space_elems), frame_table_offset(frame_space_start), frame_committed_end(frame_space_start),
+	nursery_start(max_table), nursery_offset(max_table),
+	local_memory(max_locals * sizeof(value)), global_memory(max_globals * sizeof(value)),
+	table_elem_memory((2 * round_to_large_granularity(max_table) + frame_space_elems) * sizeof(value)), table_key_memory((2 * round_to_large_granularity(max_table) + frame_space_elems) * sizeof(table_key)),
+	local_elems(static_cast<value*>(local_memory.data())),
+	global_elems(static_cast<value*>(global_memory.data())),
+	table_elems(static_cast<value*>(table_elem_memory.data())),
+	table_keys(static_cast<table_key*>(table_key_memory.data()))
 {
+	bool committed = grow_table_heap(std::min(max_table, min_table_soft_limit));
+	assert(committed);
+	if (large_space_end > large_space_start) {
+		free_large_ranges.insert({ large_space_start, large_space_end - large_space_start });
+	}
+}
+
+instance::instance(instance& source, allocator& str_allocator) : instance(source.max_locals, source.max_globals, source.max_table, str_allocator) {
+	assert(source.exec_depth == 0);
+	if (source.collection_phase != GC_IDLE) {
+		source.garbage_collect(gc_collection_mode::FINALIZE_COLLECT_RETURN); //marks and gray lists aren't worth copying
+	}
+
+	//strings belong to a single instance's allocator and collector, so they're the only objects copied one by one
+	spp::sparse_hash_map<string_header*, string_header*> copied_strs(source.active_strs.size());
+	active_strs.reserve(source.active_strs.size());
+	for (string_header* str : source.active_strs) {
+		size_t size = sizeof(string_header) + (str->is_rope ? sizeof(rope_node) : str->length + 1);
+		string_header* copy = (string_header*)str_allocator.allocate(size);
+		assert(copy != NULL);
+		std::memcpy(copy, str, size);
+
+		if (str->is_rope) {
+			copy->rope()->flattened_allocator = &str_allocator;
+			if (str->rope()->flattened != NULL) {
+				copy->rope()->flattened = (char*)str_allocator.allocate(str->length + 1);
+				assert(copy->rope()->flattened != NULL);
+				std::memcpy(copy->rope()->flattened, str->rope()->flattened, str->length + 1);
+			}
+		}
+		active_strs.push_back(copy);
+		copied_strs.insert({ str, copy });
+	}
+	for (string_header* copy : active_strs) {
+		if (copy->is_rope && copy->rope()->flattened == NULL) {
+			copy->rope()->left = copied_strs[copy->rope()->left];
+			copy->rope()->right = copied_strs[copy->rope()->right];
+		}
+	}
+	active_str_bytes = source.active_str_bytes;
+
+	auto copy_value = [&copied_strs](value val) -> value {
+		return val.type() == vtype::STRING ? value(copied_strs[val.str()]) : val;
+	};
+
+	//every other object keeps its id, so tables, closures and foreign resources are copied without being rewritten
+	bool committed = grow_table_heap(source.table_soft_limit) && global_memory.commit(source.global_offset * sizeof(value)) && local_memory.commit(source.top_level_local_offset * sizeof(value));
+	if (committed && source.nursery_start < max_table) {
+		committed = table_elem_memory.commit_range(source.nursery_start * sizeof(value), (max_table - source.nursery_start) * sizeof(value)) &&
+			table_key_memory.commit_range(source.nursery_start * sizeof(table_key), (max_table - source.nursery_start) * sizeof(table_key));
+	}
+	assert(committed);
+
+	table_entries = source.table_entries;
+	for (uint32_t slot = 0; slot < table_entries.slot_count(); slot++) {
+		std::optional<uint64_t> id = table_entries.id_at(slot);
+		if (!id.has_value()) {
+			continue;
+		}
+
+		const table_entry& entry = table_entries[id.value()];
+		size_t start = entry.block.table_start;
+		if (start >= large_space_start) {
+			committed = table_elem_memory.commit_range(start * sizeof(value), entry.block.allocated_capacity * sizeof(value)) &&
+				table_key_memory.commit_range(start * sizeof(table_key), entry.block.allocated_capacity * sizeof(table_key));
+			assert(committed);
+		}
+
+		std::memcpy(&table_elems[start], &source.table_elems[start], entry.used_elems * sizeof(value));
+		std::memcpy(&table_keys[start], &source.table_keys[start], entry.used_elems * sizeof(table_key));
+		for (uint32_t i = 0; i < entry.used_elems; i++) {
+			table_elems[start + i] = copy_value(table_elems[start + i]);
+			table_keys[start + i].key = copy_value(table_keys[start + i].key);
+		}
+	}
+	for (uint32_t i = 0; i < source.global_offset; i++) {
+		global_elems[i] = copy_value(source.global_elems[i]);
+	}
+	for (uint32_t i = 0; i < source.top_level_local_offset; i++) {
+		local_elems[i] = copy_value(source.local_elems[i]);
+	}
+
+	local_offset = source.local_offset;
+	extended_local_offset = source.extended_local_offset;
+	global_offset = source.global_offset;
+	table_offset = source.table_offset;
+	current_ip = source.current_ip;
+
+	loaded_instructions = source.loaded_instructions;
+	free_code_segments = source.free_code_segments;
+	ip_src_locs = source.ip_src_locs;
+	top_level_local_offset = source.top_level_local_offset;
+	top_level_code_start = source.top_level_code_start;
+
+	function_entries = source.function_entries;
+	for (uint32_t slot = 0; slot < function_entries.slot_count(); slot++) {
+		std::optional<uint32_t> id = function_entries.id_at(slot);
+		if (id.has_value()) {
+			for (string_header*& str : function_entries[id.value()].referenced_const_strs) {
+				str = copied_strs[str];
+			}
+		}
+	}
+	std::copy(std::begin(source.free_blocks), std::end(source.free_blocks), std::begin(free_blocks));
+	free_block_classes = source.free_block_classes;
+
+	class_entries = source.class_entries;
+	for (uint32_t slot = 0; slot < class_entries.slot_count(); slot++) {
+		std::optional<uint32_t> id = class_entries.id_at(slot);
+		if (id.has_value()) {
+			for (std::pair<value, uint32_t>& method : class_entries[id.value()].methods) {
+				method.first = copy_value(method.first);
+			}
+		}
+	}
+	method_call_sites = source.method_call_sites;
+	for (uint32_t slot = 0; slot < method_call_sites.slot_count(); slot++) {
+		std::optional<uint32_t> id = method_call_sites.id_at(slot);
+		if (id.has_value()) {
+			method_call_sites[id.value()].key = copy_value(method_call_sites[id.value()].key);
+		}
+	}
+	toplevel_call_sites = source.toplevel_call_sites;
+	toplevel_const_strs.reserve(source.toplevel_const_strs.size());
+	for (string_header* str : source.toplevel_const_strs) {
+		toplevel_const_strs.push_back(copied_strs[str]);
+	}
+
+	constants = source.constants;
+	for (uint32_t slot = 0; slot < constants.slot_count(); slot++) {
+		std::optional<uint32_t> id = constants.id_at(slot);
+		if (id.has_value()) {
+			constants[id.value()] = copy_value(constants[id.value()]);
+		}
+	}
+	added_constant_hashes = source.added_constant_hashes;
+	for (auto& interned : source.interned_strs) {
+		string_header* str = constants[interned.second].str();
+		interned_strs.insert({ std::string_view(str->chars(), str->length), interned.second });
+	}
+
+	//foreign resources are shared; each instance holds a reference
+	foreign_resources = source.foreign_resources;
+	for (uint32_t slot = 0; slot < foreign_resources.slot_count(); slot++) {
+		std::optional<uint32_t> id = foreign_resources.id_at(slot);
+		if (id.has_value()) {
+			foreign_resources[id.value()]->ref();
+		}
+	}
+
+	collection_policy = source.collection_policy;
+	gc_step_budget = source.gc_step_budget;
+	table_marks = source.table_marks;
+	function_marks = source.function_marks;
+	class_marks = source.class_marks;
+	constant_marks = source.constant_marks;
+	foreign_marks = source.foreign_marks;
+	table_sweep_cursor = source.table_sweep_cursor;
+	str_sweep_cursor = source.str_sweep_cursor;
+	allocated_elems = source.allocated_elems;
+	table_soft_limit_floor = source.table_soft_limit_floor;
+
+	free_large_ranges = source.free_large_ranges;
+	large_elems = source.large_elems;
+
+	nursery_capacity = source.nursery_capacity;
+	nursery_start = source.nursery_start;
+	nursery_offset = source.nursery_offset;
+	evaluation_region = source.evaluation_region;
+	young_tables = source.young_tables;
+	remembered_tables = source.remembered_tables;
 
+	gc_mark_threads = source.gc_mark_threads;
+	parallel_mark_min_elems = source.parallel_mark_min_elems;
 }
 
 instance::~instance() {
-	for (char* str : active_strs) {
-		free(str);
+	for (string_header* str : active_strs) {
+		free_string(str);
 	}
-	for (auto it = table_entries.ne_cbegin(); it != table_entries.ne_cend(); it++) {
-		free(it->key_hashes);
-	}
-	for (auto it = foreign_resources.begin(); it != foreign_resources.end(); it++) {
-		foreign_resource* resource = *it;
-		resource->unref();
+	for (uint32_t slot = 0; slot < foreign_resources.slot_count(); slot++) {
+		std::optional<uint32_t> id = foreign_resources.id_at(slot);
+		if (id.has_value()) {
+			foreign_resources[id.value()]->unref();
+		}
 	}
 
-	free(local_elems);
-	free(global_elems);
-	free(table_elems);
 }
 
 uint32_t instance::add_constant(value constant) {
@@ -39,30 +215,135 @@ uint32_t instance::add_constant(value constant) {
 
 	auto it = added_constant_hashes.find(hash);
 	if (it == added_constant_hashes.end()) {
-		uint32_t id;
-		if (available_constant_ids.empty())
-			id = static_cast<uint32_t>(constants.size());
-		else {
-			id = available_constant_ids.back();
-			available_constant_ids.pop_back();
-		}
-
-		if (constant.type() == vtype::STRING) {
-			char* to_store = strdup(constant.str());
-			assert(to_store != NULL);
-			active_strs.insert(to_store);
-			constant = value(to_store);
-		}
-		if (id == constants.size()) {
-			constants.resize(id + 1);
-		}
-		constants.set(id, constant);
+		uint32_t id = constants.add(constant);
 		added_constant_hashes.insert({ hash, id });
 		return id;
 	}
+	else if (!constants[it->second].equals(constant)) {
+		return constants.add(constant); //hash collision; the constant just isn't deduplicated
+	}
+	return it->second;
+}
+
+//string constants are interned: there is only ever one constant string with the same contents
+uint32_t instance::add_constant_str(const char* str) {
+	std::string_view view(str);
+
+	auto it = interned_strs.find(view);
+	if (it == interned_strs.end()) {
+		string_header* header = allocate_string(str, static_cast<uint32_t>(view.size()), key_str_hash(view.data(), view.size()), true);
+		uint32_t id = constants.add(value(header));
+		interned_strs.insert({ std::string_view(header->chars(), header->length), id });
+		return id;
+	}
+
+	//while a cycle is underway the string may still be unmarked and about to be swept, even though new code is about to load it
+	if (collection_phase != GC_IDLE) {
+		shade(constants[it->second]);
+	}
 	return it->second;
 }
 
+//resources are only looked up when they're shared, or another instance has registered them since; otherwise they're new to this one
+uint32_t instance::register_foreign_resource(foreign_resource* resource, bool assume_ownership) {
+	if ((resource->registry != NULL && resource->registry != this) || resource->ref_count.load(std::memory_order_relaxed) > 0) {
+		for (uint32_t slot = 0; slot < foreign_resources.slot_count(); slot++) {
+			std::optional<uint32_t> id = foreign_resources.id_at(slot);
+			if (id.has_value() && foreign_resources[id.value()] == resource) {
+				return id.value();
+			}
+		}
+	}
+
+	if (!assume_ownership) {
+		resource->ref();
+	}
+	uint32_t id = foreign_resources.add(resource);
+	if (resource->ref_count.load(std::memory_order_relaxed) == 0) {
+		resource->registry = this;
+		resource->handle = id;
+	}
+	return id;
+}
+
+string_header* instance::allocate_string(const char* str, uint32_t length, uint64_t hash, bool interned) {
+	string_header* header = (string_header*)str_allocator.allocate(sizeof(string_header) + length + 1);
+	assert(header != NULL);
+
+	header->hash = hash;
+	header->length = length;
+	header->marked = collection_phase != GC_IDLE; //new strings are appended after the sweep cursor
+	header->interned = interned;
+	header->is_rope = false;
+	std::memcpy(header->chars(), str, length);
+	header->chars()[length] = '\0';
+
+	active_strs.push_back(header);
+	active_str_bytes += sizeof(string_header) + length + 1;
+	collection_policy.add_str_debt(sizeof(string_header) + length + 1);
+	return header;
+}
+
+string_header* instance::allocate_rope(string_header* left, string_header* right) {
+	string_header* header = (string_header*)str_allocator.allocate(sizeof(string_header) + sizeof(rope_node));
+	assert(header != NULL);
+
+	header->hash = 0;
+	header->length = left->length + right->length;
+	header->marked = collection_phase != GC_IDLE;
+	header->interned = false;
+	header->is_rope = true;
+	*header->rope() = {
+		.left = left,
+		.right = right,
+		.flattened = NULL,
+		.flattened_allocator = &str_allocator
+	};
+	if (collection_phase == GC_MARKING) { //the rope is already black, so its children can't stay white
+		shade(value(left));
+		shade(value(right));
+	}
+
+	active_strs.push_back(header);
+	active_str_bytes += sizeof(string_header) + sizeof(rope_node) + header->length + 1; //counts the eventual flattened buffer up front
+	collection_policy.add_str_debt(sizeof(string_header) + sizeof(rope_node) + header->length + 1);
+	return header;
+}
+
+string_header* instance::concat_strings(string_header* left, string_header* right) {
+	if (left->length == 0) {
+		return right;
+	}
+	else if (right->length == 0) {
+		return left;
+	}
+
+	uint32_t length = left->length + right->length;
+	if (length >= min_rope_length) {
+		return allocate_rope(left, right);
+	}
+
+	//both operands are flat, since unflattened ropes are never shorter than min_rope_length
+	char buffer[min_rope_length];
+	std::memcpy(buffer, left->chars(), left->length);
+	std::memcpy(buffer + left->length, right->chars(), right->length);
+	return allocate_string(buffer, length, key_str_hash(buffer, length), false);
+}
+
+void instance::free_string(string_header* str) {
+	if (str->is_rope) {
+		if (str->rope()->flattened != NULL) {
+			str_allocator.release(str->rope()->flattened, str->length + 1);
+		}
+		active_str_bytes -= sizeof(string_header) + sizeof(rope_node) + str->length + 1;
+		str_allocator.release(str, sizeof(string_header) + sizeof(rope_node));
+	}
+	else {
+		active_str_bytes -= sizeof(string_header) + str->length + 1;
+		str_allocator.release(str, sizeof(string_header) + str->length + 1);
+	}
+}
+
 error instance::type_error(vtype expected, vtype got) {
 	static const char* type_names[] = {
 		"nil",
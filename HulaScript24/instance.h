@@ -5,9 +5,13 @@
 #include <vector>
 #include <map>
 #include <string>
+#include <string_view>
 #include <optional>
 #include <variant>
 #include <memory>
+#include <algorithm>
+#include <bit>
+#include <atomic>
 
 #include "sparsepp/spp.h"
 
@@ -15,6 +19,9 @@
 #include "value.h"
 #include "instructions.h"
 #include "hash.h"
+#include "slot_map.h"
+#include "mark_bitmap.h"
+#include "virtual_arena.h"
 
 namespace HulaScript::Compilation {
 	class compiler;
@@ -28,7 +35,10 @@ namespace HulaScript::Runtime {
 		class foreign_resource
 		{
 		public:
-			foreign_resource() : ref_count(0) { }
+			foreign_resource() : ref_count(0), registry(NULL), handle(0) { }
+			//a copy is a new resource with no holders yet, while assigning to a resource leaves its holders as they are
+			foreign_resource(const foreign_resource&) : ref_count(0), registry(NULL), handle(0) { }
+			foreign_resource& operator=(const foreign_resource&) { return *this; }
 
 			virtual void release() { }
 
@@ -39,46 +49,150 @@ namespace HulaScript::Runtime {
 
 			virtual std::string to_print_string() { return "foreign resource"; }
 
+			//the count is atomic since clones running on other threads share their source's resources
 			void unref() {
-				if (ref_count == 0) {
+				if (ref_count.fetch_sub(1, std::memory_order_acq_rel) == 0) {
 					this->release();
 					delete this;
 				}
-				else {
-					ref_count--;
-				}
 			}
 
 			foreign_resource* ref() {
-				ref_count++;
+				ref_count.fetch_add(1, std::memory_order_relaxed);
 				return this;
 			}
 
 		private:
-			size_t ref_count;
+			std::atomic<size_t> ref_count; //holders besides the first
+
+			//the instance that registered the resource last, and the handle it was given there, so registering it again is free
+			//only written while the resource has a single holder, since shared resources may be registered from several threads
+			instance* registry;
+			uint32_t handle;
+
+			friend class instance;
 		};
 
-		instance(uint32_t max_locals, uint32_t max_globals, size_t max_table);
+		//decides when to collect: allocations run up a debt, and a collection is due once the debt exceeds a budget proportional to what survived the last collection
+		class gc_policy {
+		public:
+			//growth_factor is how large the heap may grow, relative to what survived, before the next collection; the minimums keep small heaps from collecting constantly
+			//collections only compact table memory once more than max_fragmentation of it is free, but outside the largest free block
+			gc_policy(double growth_factor, size_t min_debt_elems, size_t min_debt_str_bytes, double max_fragmentation = 0.25) : growth_factor(growth_factor), min_debt_elems(min_debt_elems), min_debt_str_bytes(min_debt_str_bytes), max_fragmentation(max_fragmentation), elem_debt(0), str_debt(0), elem_budget(min_debt_elems), str_budget(min_debt_str_bytes) { }
+
+			void add_elem_debt(size_t elems) {
+				elem_debt += elems;
+			}
+
+			void add_str_debt(size_t bytes) {
+				str_debt += bytes;
+			}
+
+			bool collection_due() const {
+				return elem_debt >= elem_budget || str_debt >= str_budget;
+			}
+
+			//table memory is bounded, so a collection is also due once half of what's left is used
+			void collected(size_t live_elems, size_t live_str_bytes, size_t max_table) {
+				elem_debt = 0;
+				str_debt = 0;
+				elem_budget = std::max(min_debt_elems, std::min(static_cast<size_t>(live_elems * (growth_factor - 1)), (max_table - live_elems) / 2));
+				str_budget = std::max(min_debt_str_bytes, static_cast<size_t>(live_str_bytes * (growth_factor - 1)));
+			}
+
+			bool should_compact(size_t scattered_free_elems, size_t table_elems) const {
+				return scattered_free_elems > table_elems * max_fragmentation;
+			}
+		private:
+			double growth_factor;
+			size_t min_debt_elems, min_debt_str_bytes;
+			double max_fragmentation;
+
+			size_t elem_debt, str_debt;
+			size_t elem_budget, str_budget;
+		};
+
+		instance(uint32_t max_locals, uint32_t max_globals, size_t max_table, allocator& str_allocator = allocator::system());
+		//an independent copy of an instance between executions, for hosts that would otherwise set up many instances the same way
+		//table, code and constant memory is copied in bulk, strings are copied into str_allocator, and foreign resources are shared by reference count
+		//clones may run on other threads than their source, as long as the foreign resources they share are themselves safe to use from those threads
+		instance(instance& source, allocator& str_allocator);
 		~instance();
 
+		std::unique_ptr<instance> clone(allocator& str_allocator = allocator::system()) {
+			return std::make_unique<instance>(*this, str_allocator);
+		}
+
 		result_t execute();
 		result_t call(value function, std::vector<value>& args);
 
 		std::string value_to_print_str(value& val) const;
 
+		//makes a garbage collected string with a copy of the characters
+		value make_string(std::string_view str) {
+			return value(allocate_string(str.data(), static_cast<uint32_t>(str.size()), key_str_hash(str.data(), str.size()), false));
+		}
+
+		//values refer to foreign resources by a handle into the registry
 		value make_foreign_resource(foreign_resource* resource, bool assume_ownership=true) {
-			auto res = foreign_resources.insert(resource);
-			if (res.second && !assume_ownership) {
-				resource->ref();
+			if (resource->registry == this && foreign_resources.contains(resource->handle) && foreign_resources[resource->handle] == resource) {
+				return value(vtype::FOREIGN_RESOURCE, static_cast<uint64_t>(resource->handle));
 			}
-			return value(vtype::FOREIGN_RESOURCE, static_cast<void*>(resource));
+			return value(vtype::FOREIGN_RESOURCE, static_cast<uint64_t>(register_foreign_resource(resource, assume_ownership)));
+		}
+
+		foreign_resource* get_foreign_resource(value val) const {
+			assert(val.type() == vtype::FOREIGN_RESOURCE);
+			return foreign_resources[val.foreign_id()];
 		}
 
 		void set_global(uint32_t global_id, value& val) {
 			assert(global_id < global_offset);
+			write_barrier(val);
 			global_elems[global_id] = val;
 		}
 
+		void set_gc_policy(gc_policy policy) {
+			collection_policy = policy;
+		}
+
+		//with a step budget, allocations advance collection cycles in bounded slices of work (roughly, values scanned or objects swept) instead of stopping for a full collection
+		//full collections still happen when table memory runs out; unreachable functions and classes are only freed by the full collection hibernate() does
+		void set_incremental_gc(std::optional<uint32_t> step_budget) {
+			gc_step_budget = step_budget;
+		}
+
+		//with a nursery, new tables are bump allocated at the top of table memory; minor collections copy the survivors into the old generation and discard the rest at once
+		//minor collections trace from the roots and the tables remembered to point into the nursery, so their cost follows live young tables rather than the whole heap
+		void set_generational_gc(std::optional<uint32_t> nursery_elems);
+
+		//for hosts keeping many instances around at once: the table heap shrinks back to a much smaller floor, so an idle instance holds little more than its live data
+		void set_high_density(bool enabled) {
+			table_soft_limit_floor = enabled ? high_density_table_soft_limit : min_table_soft_limit;
+		}
+
+		//collects, compacts and gives every buffer's unused pages back to the os; meant for instances about to sit idle
+		//memory is committed again as it's needed, and the nursery when execution resumes
+		void hibernate();
+
+		//for hosts whose executions are one-shot evaluations: their tables are allocated in a region of region_elems elements
+		//when execution returns to the host, only what's reachable from globals, top level locals and the result is evacuated into the heap, and the region is reset at once
+		void set_evaluation_region(std::optional<uint32_t> region_elems) {
+			evaluation_region = region_elems.has_value();
+			set_generational_gc(region_elems);
+		}
+
+		//marks tables on thread_count threads once the live table heap holds at least min_heap_elems elements; smaller heaps aren't worth starting threads for
+		void set_parallel_gc(uint32_t thread_count, size_t min_heap_elems) {
+			gc_mark_threads = std::max(thread_count, static_cast<uint32_t>(1));
+			parallel_mark_min_elems = min_heap_elems;
+		}
+
+		//ropes are flattened the first time their characters or hash are needed; returns false if there's no memory left to do so
+		static bool flatten_operand(value& val) {
+			return val.type() != vtype::STRING || val.str()->is_flat() || val.str()->flatten();
+		}
+
 		error make_error(etype type, std::optional<std::string> msg) const {
 			std::vector<std::pair<std::optional<source_loc>, uint32_t>> stack_trace;
 			for (auto it = return_stack.begin(); it != return_stack.end(); ) {
@@ -99,31 +213,83 @@ namespace HulaScript::Runtime {
 			FINALIZE_COLLECT_RETURN = 2
 		};
 
+		//marked objects are gray while on a gray stack and black once scanned; unmarked objects are white
+		enum gc_phase {
+			GC_IDLE,
+			GC_MARKING,
+			GC_SWEEPING
+		};
+
+		static constexpr size_t min_str_collect_debt = 1 << 20;
+		static constexpr uint32_t min_rope_length = 32; //shorter concatenations are copied immediately
+		static constexpr size_t min_table_soft_limit = 1 << 16; //table elements committed up front; the heap grows past this by doubling
+		static constexpr size_t high_density_table_soft_limit = 1 << 10;
+		static constexpr uint32_t large_table_elems = 1 << 16; //tables at least this big are kept in the large object space, which is never compacted
+		static constexpr size_t large_table_granularity = 4096; //large blocks are sized in multiples of this, so each one covers whole pages
+		static constexpr size_t frame_space_elems = 1 << 16;
+
+		static constexpr size_t round_to_large_granularity(size_t elems) {
+			return (elems + large_table_granularity - 1) / large_table_granularity * large_table_granularity;
+		}
+		static constexpr uint32_t exact_block_classes = 16; //free blocks smaller than this are kept by exact size, larger ones by power of two
+		static constexpr uint32_t block_class_count = exact_block_classes + 32 - std::bit_width(exact_block_classes - 1);
+
 		struct gc_block {
 			size_t table_start;
 			uint32_t allocated_capacity;
 		};
 
+		//an entry in a table's key index, which is kept sorted by hash
+		struct table_key {
+			uint64_t hash;
+			uint32_t slot;
+			value key; //kept so hash matches can be verified
+		};
+
+		//a table's key index lives in table_keys, at the same offsets as its elements in table_elems
 		struct table_entry {
-			std::pair<uint64_t, uint32_t>* key_hashes;
-			uint32_t key_hash_capacity;
 			uint32_t used_elems = 0;
 			
 			gc_block block;
+			std::optional<uint32_t> class_id = std::nullopt;
+			bool young = false; //allocated in the nursery, and not yet promoted
+			bool remembered = false; //an old table in the remembered set
+		};
+
+		//per-class data shared by every instance of a class
+		struct class_entry {
+			std::vector<std::pair<value, uint32_t>> methods; //method names (interned constant strings) and their function ids, sorted by key hash
+			uint32_t property_count = 0;
+		};
+
+		//a CALL_METHOD instruction's operands, and a cache of the last method it resolved through a class
+		struct method_call_site {
+			value key;
+			uint32_t argument_count = 0;
+
+			std::optional<uint32_t> cached_class_id = std::nullopt;
+			uint32_t cached_function_id = 0;
 		};
 
 		struct loaded_function_entry {
 			uint32_t start_address = 0;
 			std::vector<uint32_t> referenced_func_ids;
-			std::vector<char*> referenced_const_strs;
+			std::vector<uint32_t> referenced_class_ids; //classes the function instantiates, which live as long as it or their instances do
+			std::vector<string_header*> referenced_const_strs;
+			std::vector<uint32_t> referenced_const_nums;
+			std::vector<uint32_t> method_call_sites; //released along with the function's code
 			uint32_t length = 0;
 
 			uint32_t parameter_count = 0;
 		};
 
+		//max_locals, max_globals and max_table only reserve address space; memory is committed as it's used
+		virtual_arena local_memory, global_memory, table_elem_memory, table_key_memory;
+
 		value* local_elems;
 		value* global_elems;
 		value* table_elems;
+		table_key* table_keys; //parallel to table_elems, so blocks move and free together with their keys
 
 		std::vector<value> evaluation_stack;
 		std::vector<value> scratchpad_stack;
@@ -134,41 +300,226 @@ namespace HulaScript::Runtime {
 		size_t table_offset, max_table;
 
 		std::vector<instruction> loaded_instructions;
+		std::map<uint32_t, uint32_t> free_code_segments; //start address and length of the holes dead functions left behind; code is never moved
 		std::map<uint32_t, source_loc> ip_src_locs;
 		uint32_t top_level_local_offset, exec_depth;
+		uint32_t top_level_code_start; //top level code is loaded last, and discarded once it finishes executing
 		
-		spp::sparsetable<loaded_function_entry, SPP_DEFAULT_ALLOCATOR<loaded_function_entry>> function_entries;
-		std::vector<uint32_t> available_function_ids;
+		slot_map<loaded_function_entry, uint32_t, 24> function_entries;
 		
-		spp::sparsetable<table_entry, SPP_DEFAULT_ALLOCATOR<table_entry>> table_entries;
-		std::vector<uint64_t> available_table_ids;
-		std::multimap<uint32_t, gc_block> free_tables;
-		spp::sparse_hash_set<char*> active_strs;
-
-		spp::sparsetable<value, SPP_DEFAULT_ALLOCATOR<value>> constants;
+		slot_map<table_entry, uint64_t, 32> table_entries;
+		std::vector<gc_block> free_blocks[block_class_count];
+		uint64_t free_block_classes = 0; //bit i is set while free_blocks[i] isn't empty
+
+		slot_map<class_entry, uint32_t, 24> class_entries;
+		slot_map<method_call_site, uint32_t, 24> method_call_sites;
+		std::vector<uint32_t> toplevel_call_sites;
+		allocator& str_allocator;
+		std::vector<string_header*> active_strs;
+		size_t active_str_bytes;
+		std::vector<string_header*> toplevel_const_strs;
+
+		slot_map<value, uint32_t, 24> constants;
 		spp::sparse_hash_map<uint64_t, uint32_t> added_constant_hashes;
-		std::vector<uint32_t> available_constant_ids;
+		spp::sparse_hash_map<std::string_view, uint32_t, key_str_hasher> interned_strs; //views into the interned constant strings themselves
+
+		slot_map<foreign_resource*, uint32_t, 24> foreign_resources;
+
+		gc_policy collection_policy;
+		gc_phase collection_phase = GC_IDLE;
+		std::optional<uint32_t> gc_step_budget = std::nullopt;
+		std::vector<uint64_t> gray_tables;
+		std::vector<string_header*> gray_strs;
+		std::vector<uint32_t> gray_functions;
+		mark_bitmap table_marks; //indexed by table slot
+		mark_bitmap function_marks; //indexed by function slot
+		mark_bitmap class_marks; //indexed by class slot
+		mark_bitmap constant_marks; //indexed by constant slot
+		mark_bitmap foreign_marks; //indexed by foreign resource slot
+		uint32_t table_sweep_cursor = 0;
+		size_t str_sweep_cursor = 0;
+		size_t allocated_elems = 0; //total capacity of live table blocks
+		size_t table_soft_limit; //old tables are bump allocated below this before a collection is forced; [0, table_soft_limit) is committed
+		size_t table_soft_limit_floor = min_table_soft_limit; //trimming never goes below this
+
+		//the large object space spans [large_space_start, large_space_end), above the nursery, and is as big as max_table
+		//each large table has pages of its own, committed when it's allocated and given back when it dies
+		size_t large_space_start, large_space_end;
+		std::map<size_t, size_t> free_large_ranges; //start and length of each free range, in elements
+		size_t large_elems = 0; //total capacity of live large tables
+
+		//tables that never outlive the function that allocated them are bump allocated in [frame_space_start, frame_space_end), above the large object space
+		//they're freed when that function returns, without the garbage collector; once the frame space is full they go on the heap, but are still freed on return
+		struct frame_table {
+			uint64_t id;
+			size_t depth; //return stack depth of the frame that allocated it
+			size_t start; //frame_table_offset before it was allocated
+		};
+		std::vector<frame_table> frame_tables;
+		size_t frame_space_start, frame_space_end, frame_table_offset, frame_committed_end;
 
-		spp::sparse_hash_set<foreign_resource*> foreign_resources;
+		//the nursery spans [nursery_start, max_table) and only holds tables while no major cycle is underway
+		size_t nursery_capacity = 0, nursery_start, nursery_offset;
+		bool evaluation_region = false; //the nursery is emptied whenever execution returns to the host
+		std::vector<uint64_t> young_tables;
+		std::vector<uint64_t> remembered_tables; //old tables that may reference young tables
+
+		uint32_t gc_mark_threads = 1;
+		size_t parallel_mark_min_elems = 0;
 
 		error type_error(vtype expected, vtype got);
 
 		std::optional<gc_block> allocate_block(uint32_t element_count);
+		bool grow_table_heap(size_t min_elems);
+		std::optional<gc_block> allocate_large_block(uint32_t element_count);
+		bool extend_large_block(gc_block& block, uint32_t element_count);
+		void release_large_block(gc_block block);
+		void free_large_range(size_t start, size_t length);
+		void trim_table_heap();
+		std::optional<gc_block> allocate_old_block(uint32_t element_count);
+		std::optional<gc_block> allocate_promoted_block(uint32_t element_count);
+		std::optional<gc_block> take_free_block(uint32_t element_count);
+		void add_free_block(gc_block block);
+		uint32_t coalesce_free_blocks();
+		void compact_tables();
 		std::optional<uint64_t> allocate_table(uint32_t element_count);
+		std::optional<uint64_t> allocate_frame_table(uint32_t element_count);
+		void release_frame_tables(size_t depth);
+		std::optional<uint64_t> clone_table(uint64_t table_id);
 		bool reallocate_table(uint64_t table, uint32_t element_count);
 		bool reallocate_table(uint64_t table, uint32_t max_elem_extend, uint32_t min_elem_extend);
 
 		void garbage_collect(gc_collection_mode mode);
+		void finalize_execution(gc_collection_mode mode);
+		void gc_allocation_step();
+		void gc_begin_cycle();
+		bool gc_mark_step(size_t budget);
+		void gc_parallel_mark();
+		void gc_finish_marking(gc_collection_mode mode);
+		bool gc_sweep_step(size_t budget);
+		void release_block(gc_block block);
+		void move_table_contents(size_t dest_start, size_t src_start, uint32_t count);
+		uint32_t allocate_code(const std::vector<instruction>& code);
+		void release_code(uint32_t start_address, uint32_t length);
+		void gc_minor_collect();
+		bool gc_promote(value val);
+		void gc_reset_generations();
+
+		void shade(value val);
+		void shade_function(uint32_t function_id);
+		void shade_class(uint32_t class_id);
+
+		//keeps the tri-color invariant while marking: a value stored into a root or a marked table must not stay white
+		void write_barrier(value val) {
+			if (collection_phase == GC_MARKING) {
+				shade(val);
+			}
+		}
+
+		//also records old tables that come to reference young ones, since minor collections don't scan the old generation
+		void table_write_barrier(uint64_t table_id, table_entry& entry, value val) {
+			if (collection_phase == GC_MARKING && table_marks.test(table_entries.slot_of(table_id))) {
+				shade(val);
+			}
+			else if (!young_tables.empty() && !entry.young && !entry.remembered && is_young(val)) {
+				remember_table(table_id, entry);
+			}
+		}
+
+		bool is_young(value val) {
+			switch (val.type())
+			{
+			case vtype::TABLE:
+				return table_entries[val.table_id()].young;
+			case vtype::CLOSURE:
+				return table_entries[val.closure().second].young;
+			default:
+				return false;
+			}
+		}
+
+		void remember_table(uint64_t table_id, table_entry& entry) {
+			entry.remembered = true;
+			remembered_tables.push_back(table_id);
+		}
+
+		void release_method_call_sites(std::vector<uint32_t>& call_site_ids) {
+			for (uint32_t id : call_site_ids) {
+				method_call_sites.remove(id);
+			}
+			call_site_ids.clear();
+		}
+
+		//call sites may have cached a method of a class or function that has just been freed, and its id may be handed out again
+		void forget_cached_methods() {
+			for (uint32_t slot = 0; slot < method_call_sites.slot_count(); slot++) {
+				std::optional<uint32_t> id = method_call_sites.id_at(slot);
+				if (id.has_value()) {
+					method_call_sites[id.value()].cached_class_id = std::nullopt;
+				}
+			}
+		}
+
+		//objects made while a cycle is underway must survive it
+		bool allocate_marked(uint32_t table_slot) const {
+			return collection_phase == GC_MARKING || (collection_phase == GC_SWEEPING && table_slot >= table_sweep_cursor);
+		}
 
 		uint32_t emit_function_start(std::vector<instruction>& instructions);
+		uint32_t emit_class(std::vector<std::pair<value, uint32_t>> methods, uint32_t property_count);
+		uint32_t emit_method_call_site(value name, uint32_t argument_count);
 		uint32_t add_constant(value constant);
+		uint32_t add_constant_str(const char* str);
+		string_header* allocate_string(const char* str, uint32_t length, uint64_t hash, bool interned);
+		uint32_t register_foreign_resource(foreign_resource* resource, bool assume_ownership);
+		string_header* allocate_rope(string_header* left, string_header* right);
+		string_header* concat_strings(string_header* left, string_header* right);
+		void free_string(string_header* str);
+
+		static uint32_t block_class(uint32_t element_count) {
+			if (element_count < exact_block_classes) {
+				return element_count;
+			}
+			return exact_block_classes + std::bit_width(element_count) - std::bit_width(exact_block_classes);
+		}
 
-		uint32_t add_constant_strhash(uint64_t str_hash) {
-			return add_constant(value(vtype::INTERNAL_CONSTHASH, hash_combine(str_hash, (uint64_t)vtype::STRING)));
+		//searches a table's key index; returns the key's position if it's present, otherwise the position to insert it at
+		table_key* keys_of(const table_entry& entry) const {
+			return &table_keys[entry.block.table_start];
 		}
-		
-		uint32_t add_constant_key(value key) {
-			return add_constant(value(vtype::INTERNAL_CONSTHASH, key.compute_hash()));
+
+		const std::pair<uint32_t, bool> find_key(const table_entry& entry, const value& key, uint64_t hash) const {
+			const table_key* keys = keys_of(entry);
+			uint32_t low = 0;
+			uint32_t high = entry.used_elems;
+			while (low < high) {
+				uint32_t mid = low + (high - low) / 2;
+				if (keys[mid].hash < hash) {
+					low = mid + 1;
+				}
+				else {
+					high = mid;
+				}
+			}
+			for (; low < entry.used_elems && keys[low].hash == hash; low++) {
+				if (keys[low].key.equals(key)) {
+					return std::make_pair(low, true);
+				}
+			}
+			return std::make_pair(low, false);
+		}
+
+		const std::optional<uint32_t> find_method(uint32_t class_id, const value& key, uint64_t hash) const {
+			const std::vector<std::pair<value, uint32_t>>& methods = class_entries[class_id].methods;
+			auto it = std::lower_bound(methods.begin(), methods.end(), hash, [](const std::pair<value, uint32_t>& method, uint64_t hash) {
+				return method.first.compute_hash() < hash;
+			});
+			for (; it != methods.end() && it->first.compute_hash() == hash; it++) {
+				if (it->first.equals(key)) {
+					return it->second;
+				}
+			}
+			return std::nullopt;
 		}
 
 		const std::optional<source_loc> loc_from_ip(uint32_t ip) const {
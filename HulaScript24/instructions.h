@@ -27,6 +27,9 @@ namespace HulaScript::Runtime {
 		NEGATE,
 		NOT,
 
+		//string operators
+		CONCAT,
+
 		//variable load/store
 		LOAD_LOCAL,
 		LOAD_GLOBAL,
@@ -41,6 +44,7 @@ namespace HulaScript::Runtime {
 
 		//other miscellaneous operations
 		LOAD_CONSTANT,
+		PUSH_INT, //operand is a signed 32-bit integer
 		PUSH_NIL,
 		DISCARD_TOP,
 		PUSH_SCRATCHPAD,
@@ -53,6 +57,10 @@ namespace HulaScript::Runtime {
 		STORE_TABLE_ELEM,
 		ALLOCATE_DYN,
 		ALLOCATE_FIXED,
+		ALLOCATE_FRAME, //an ALLOCATE_FIXED whose table the compiler proved never outlives the function; it's freed on return
+		ALLOCATE_CLASS, //copies a class template table and binds it to a class's method table
+		LOAD_TABLE_SLOT, //loads a class property by its fixed slot index
+		STORE_TABLE_SLOT,
 
 		//control flow
 		COND_JUMP_AHEAD,
@@ -61,6 +69,8 @@ namespace HulaScript::Runtime {
 		JUMP_BACK,
 		IF_NIL_JUMP_AHEAD,
 		IFNT_NIL_JUMP_AHEAD, //opposite of if nil jump ahead 
+		IF_FALSE_JUMP_AHEAD, //short circuits and; leaves false on the stack if it jumps
+		IF_TRUE_JUMP_AHEAD, //short circuits or; leaves true on the stack if it jumps
 
 		//function 
 		FUNCTION,
@@ -68,6 +78,7 @@ namespace HulaScript::Runtime {
 		MAKE_CLOSURE,
 		CALL,
 		CALL_NO_CAPUTRE_TABLE,
+		CALL_METHOD, //operand is a method call site id
 		RETURN,
 
 		//invalid
@@ -6,6 +6,9 @@
 using namespace HulaScript::Runtime;
 
 std::variant<value, error> instance::execute() {
+	if (exec_depth == 0 && nursery_capacity > 0 && nursery_start == max_table && collection_phase == GC_IDLE) {
+		gc_reset_generations(); //hibernate gave the nursery back
+	}
 	instruction* instructions = loaded_instructions.data();
 	local_offset = 0;
 
@@ -15,8 +18,14 @@ std::variant<value, error> instance::execute() {
 														current_error = type_error(EXPECTED_TYPE, OPERAND_NAME.type());\
 														goto stop_exec;\
 													}\
+
+#define FLATTEN_OPERAND(OPERAND_NAME)	if(!flatten_operand(OPERAND_NAME)) {\
+											current_error = make_error(etype::MEMORY, "Failed to flatten string.");\
+											goto stop_exec;\
+										}\
 	
 	uint32_t return_depth_threshold = return_stack.size();
+	uint32_t call_arg_count;
 	std::optional<error> current_error = std::nullopt;
 	exec_depth++;
 	while (current_ip != loaded_instructions.size())
@@ -91,7 +100,11 @@ std::variant<value, error> instance::execute() {
 			evaluation_stack.pop_back();
 			value a = evaluation_stack.back();
 			evaluation_stack.pop_back();
-			evaluation_stack.push_back(value(a.compute_hash() == b.compute_hash()));
+			if (a.type() == vtype::STRING && b.type() == vtype::STRING && a.str()->length == b.str()->length) { //only strings of the same length have their characters compared
+				FLATTEN_OPERAND(a);
+				FLATTEN_OPERAND(b);
+			}
+			evaluation_stack.push_back(value(a.equals(b)));
 			goto next_ins;
 		}
 		case opcode::NOT_EQUALS: {
@@ -99,7 +112,11 @@ std::variant<value, error> instance::execute() {
 			evaluation_stack.pop_back();
 			value a = evaluation_stack.back();
 			evaluation_stack.pop_back();
-			evaluation_stack.push_back(value(a.compute_hash() != b.compute_hash()));
+			if (a.type() == vtype::STRING && b.type() == vtype::STRING && a.str()->length == b.str()->length) { //only strings of the same length have their characters compared
+				FLATTEN_OPERAND(a);
+				FLATTEN_OPERAND(b);
+			}
+			evaluation_stack.push_back(value(!a.equals(b)));
 			goto next_ins;
 		}
 		case opcode::AND: {
@@ -125,6 +142,41 @@ std::variant<value, error> instance::execute() {
 			goto next_ins;
 		}
 
+		//string operations
+		case opcode::CONCAT: {
+			//the operands are still on the evaluation stack
+			if (gc_step_budget.has_value()) {
+				gc_allocation_step();
+			}
+			else if (collection_policy.collection_due()) {
+				garbage_collect(gc_collection_mode::STANDARD);
+			}
+
+			string_header* operands[2];
+			for (int i = 1; i >= 0; i--) {
+				value operand = evaluation_stack.back();
+				evaluation_stack.pop_back();
+
+				if (operand.type() == vtype::STRING) {
+					operands[i] = operand.str();
+				}
+				else if (operand.type() == vtype::NUMBER) {
+					operands[i] = make_string(std::to_string(operand.number())).str();
+				}
+				else {
+					current_error = type_error(vtype::STRING, operand.type());
+					goto stop_exec;
+				}
+			}
+
+			if (operands[0]->length > UINT32_MAX - operands[1]->length) {
+				current_error = make_error(etype::MEMORY, "Concatenated string is too long.");
+				goto stop_exec;
+			}
+			evaluation_stack.push_back(value(concat_strings(operands[0], operands[1])));
+			goto next_ins;
+		}
+
 		//variable operations
 		case opcode::LOAD_LOCAL:
 			evaluation_stack.push_back(local_elems[ins.operand + local_offset]);
@@ -133,9 +185,11 @@ std::variant<value, error> instance::execute() {
 			evaluation_stack.push_back(global_elems[ins.operand]);
 			goto next_ins;
 		case opcode::STORE_LOCAL:
+			write_barrier(evaluation_stack.back());
 			local_elems[local_offset + ins.operand] = evaluation_stack.back();
 			goto next_ins;
 		case opcode::STORE_GLOBAL:
+			write_barrier(evaluation_stack.back());
 			global_elems[ins.operand] = evaluation_stack.back();
 			evaluation_stack.pop_back();
 			goto next_ins;
@@ -145,12 +199,14 @@ std::variant<value, error> instance::execute() {
 			[[fallthrough]];
 		case opcode::DECL_LOCAL:
 			assert(extended_local_offset == ins.operand);
+			write_barrier(evaluation_stack.back());
 			local_elems[local_offset + extended_local_offset] = evaluation_stack.back();
 			evaluation_stack.pop_back();
 			extended_local_offset++;
 			goto next_ins;
 		case opcode::DECL_GLOBAL:
 			assert(global_offset == ins.operand);
+			write_barrier(evaluation_stack.back());
 			global_elems[global_offset] = evaluation_stack.back();
 			evaluation_stack.pop_back();
 			global_offset++;
@@ -159,13 +215,13 @@ std::variant<value, error> instance::execute() {
 			extended_local_offset -= ins.operand;
 			goto next_ins;
 		case opcode::PROBE_LOCALS:
-			if (local_offset + extended_local_offset + ins.operand > max_locals) {
+			if (local_offset + extended_local_offset + ins.operand > max_locals || !local_memory.commit((local_offset + extended_local_offset + ins.operand) * sizeof(value))) {
 				current_error = make_error(etype::MEMORY, "Stack Overflow: ran out of memory while allocating local.");
 				goto stop_exec;
 			}
 			goto next_ins;
 		case opcode::PROBE_GLOBALS:
-			if (global_offset + ins.operand > max_locals) {
+			if (global_offset + ins.operand > max_globals || !global_memory.commit((global_offset + ins.operand) * sizeof(value))) {
 				current_error = make_error(etype::MEMORY, "Stack Overflow: ran out of memory while allocating globals.");
 				goto stop_exec;
 			}
@@ -173,7 +229,10 @@ std::variant<value, error> instance::execute() {
 
 		//other miscellaneous operations
 		case opcode::LOAD_CONSTANT:
-			evaluation_stack.push_back(constants.unsafe_get(ins.operand));
+			evaluation_stack.push_back(constants[ins.operand]);
+			goto next_ins;
+		case opcode::PUSH_INT:
+			evaluation_stack.push_back(value(static_cast<double>(static_cast<int32_t>(ins.operand))));
 			goto next_ins;
 		case opcode::PUSH_NIL:
 			evaluation_stack.push_back(value());
@@ -205,7 +264,7 @@ std::variant<value, error> instance::execute() {
 			auto table_val = evaluation_stack.back();
 			evaluation_stack.pop_back();
 			if (table_val.type() == vtype::FOREIGN_RESOURCE) {
-				auto resource = static_cast<foreign_resource*>(table_val.raw_ptr());
+				auto resource = get_foreign_resource(table_val);
 				auto res = resource->load_key(key_val, *this);
 				if (std::holds_alternative<error>(res)) {
 					current_error = std::get<error>(res);
@@ -224,26 +283,23 @@ std::variant<value, error> instance::execute() {
 
 			//LOAD_OPERAND(table_val, vtype::TABLE);
 
-			table_entry& table_entry = table_entries.unsafe_get(table_val.table_id());
-			uint64_t hash = key_val.compute_key_hash();
+			FLATTEN_OPERAND(key_val);
+			table_entry& table_entry = table_entries[table_val.table_id()];
+			uint64_t hash = key_val.compute_hash();
 
-			uint32_t low = 0;
-			uint32_t high = table_entry.used_elems;
-			while (low < high)
-			{
-				uint32_t mid = (high & low) + ((high ^ low) >> 1);
-				std::pair<uint64_t, uint32_t>& current = table_entry.key_hashes[mid];
+			auto position = find_key(table_entry, key_val, hash);
+			if (position.second) {
+				evaluation_stack.push_back(table_elems[table_entry.block.table_start + keys_of(table_entry)[position.first].slot]);
+				goto next_ins;
+			}
 
-				if (current.first == hash) {
-					evaluation_stack.push_back(table_elems[table_entry.block.table_start + current.second]);
+			//fall back to the shared method table of the table's class
+			if (table_entry.class_id.has_value()) {
+				std::optional<uint32_t> method = find_method(table_entry.class_id.value(), key_val, hash);
+				if (method.has_value()) {
+					evaluation_stack.push_back(value(method.value(), table_val.table_id()));
 					goto next_ins;
 				}
-				else if(hash < current.first) {
-					high = mid;
-				}
-				else {
-					low = mid + 1;
-				}
 			}
 			evaluation_stack.push_back(value());
 			goto next_ins;
@@ -257,7 +313,7 @@ std::variant<value, error> instance::execute() {
 			auto table_val = evaluation_stack.back();
 			evaluation_stack.pop_back();
 			if (table_val.type() == vtype::FOREIGN_RESOURCE) {
-				auto resource = static_cast<foreign_resource*>(table_val.raw_ptr());
+				auto resource = get_foreign_resource(table_val);
 				auto res = resource->set_key(key_val, store_val, *this);
 				if (std::holds_alternative<error>(res)) {
 					current_error = std::get<error>(res);
@@ -273,56 +329,40 @@ std::variant<value, error> instance::execute() {
 				goto stop_exec;
 			}
 
-			table_entry& table_entry = table_entries.unsafe_get(table_val.table_id());
-			uint64_t hash = key_val.compute_key_hash();
+			FLATTEN_OPERAND(key_val);
+			table_entry& table_entry = table_entries[table_val.table_id()];
+			uint64_t hash = key_val.compute_hash();
 
 			evaluation_stack.push_back(store_val);
 
-			uint32_t low = 0;
-			uint32_t high = table_entry.used_elems;
-			while (low < high)
-			{
-				//mid = (high + low) / 2;
-				uint32_t mid = (high & low) + ((high ^ low) >> 1);
-				std::pair<uint64_t, uint32_t>& current = table_entry.key_hashes[mid];
-
-				if (current.first == hash) {
-					table_elems[table_entry.block.table_start + current.second] = store_val;
-					goto next_ins;
-				}
-				else if (hash < current.first) {
-					high = mid;
-				}
-				else {
-					low = mid + 1;
-				}
+			auto position = find_key(table_entry, key_val, hash);
+			table_write_barrier(table_val.table_id(), table_entry, store_val);
+			if (position.second) {
+				table_elems[table_entry.block.table_start + keys_of(table_entry)[position.first].slot] = store_val;
+				goto next_ins;
 			}
+			table_write_barrier(table_val.table_id(), table_entry, key_val);
 
 			//protect operands from potential garbage collect during allocate
-			if (table_entry.used_elems == table_entry.key_hash_capacity) {
-				table_entry.key_hash_capacity += 1;
-				auto new_buffer = (std::pair<uint64_t, uint32_t>*)realloc(table_entry.key_hashes, table_entry.key_hash_capacity * sizeof(std::pair<uint64_t, uint32_t>));
-				if (new_buffer == NULL) {
-					current_error = make_error(etype::MEMORY, "Cannot add new element to table.");
-					goto stop_exec;
-				}
-				table_entry.key_hashes = new_buffer;
-			}
-			
-			if (low < table_entry.used_elems) {
-				std::memmove(&table_entry.key_hashes[low + 1], &table_entry.key_hashes[low], (table_entry.used_elems - low) * sizeof(std::pair<uint64_t, uint32_t>));
-			}
-			table_entry.key_hashes[low] = std::make_pair(hash, table_entry.used_elems);
-			
 			if (table_entry.used_elems == table_entry.block.allocated_capacity) {
 				scratchpad_stack.push_back(table_val);
+				scratchpad_stack.push_back(key_val);
 				if (!reallocate_table(table_val.table_id(), 4, 1))
 				{
 					current_error = make_error(etype::MEMORY, "Failed to add to table.");
 					goto stop_exec;
 				}
 				scratchpad_stack.pop_back();
+				scratchpad_stack.pop_back();
 			}
+
+			//the key is only inserted once the table can hold it; a collection during reallocate only traces the first used_elems keys
+			table_key* keys = keys_of(table_entry);
+			uint32_t low = position.first;
+			if (low < table_entry.used_elems) {
+				std::memmove(&keys[low + 1], &keys[low], (table_entry.used_elems - low) * sizeof(table_key));
+			}
+			keys[low] = { .hash = hash, .slot = table_entry.used_elems, .key = key_val };
 			table_elems[table_entry.block.table_start + table_entry.used_elems] = store_val;
 			table_entry.used_elems++;
 			
@@ -358,6 +398,61 @@ std::variant<value, error> instance::execute() {
 			evaluation_stack.push_back(value(res.value()));
 			goto next_ins;
 		}
+		case opcode::ALLOCATE_FRAME: {
+			std::optional<uint64_t> res = allocate_frame_table(ins.operand);
+			if (!res.has_value()) {
+				std::stringstream ss;
+				ss << "Failed to allocate new array with " << ins.operand << " elements.";
+				current_error = make_error(etype::MEMORY, ss.str());
+				goto stop_exec;
+			}
+			evaluation_stack.push_back(value(res.value()));
+			goto next_ins;
+		}
+		case opcode::ALLOCATE_CLASS: {
+			//template table stays on the stack during allocation to protect it from garbage collection
+			if (evaluation_stack.back().type() != vtype::TABLE) {
+				current_error = type_error(vtype::TABLE, evaluation_stack.back().type());
+				goto stop_exec;
+			}
+			std::optional<uint64_t> res = clone_table(evaluation_stack.back().table_id());
+			evaluation_stack.pop_back();
+			if (!res.has_value()) {
+				current_error = make_error(etype::MEMORY, "Failed to allocate new class instance.");
+				goto stop_exec;
+			}
+			table_entries[res.value()].class_id = ins.operand;
+			if (collection_phase == GC_MARKING) {
+				shade_class(ins.operand);
+			}
+			evaluation_stack.push_back(value(res.value()));
+			goto next_ins;
+		}
+
+		case opcode::LOAD_TABLE_SLOT: {
+			value table_val = evaluation_stack.back();
+			evaluation_stack.pop_back();
+			assert(table_val.type() == vtype::TABLE);
+
+			table_entry& table_entry = table_entries[table_val.table_id()];
+			assert(ins.operand < table_entry.used_elems);
+			evaluation_stack.push_back(table_elems[table_entry.block.table_start + ins.operand]);
+			goto next_ins;
+		}
+		case opcode::STORE_TABLE_SLOT: {
+			value store_val = evaluation_stack.back();
+			evaluation_stack.pop_back();
+			value table_val = evaluation_stack.back();
+			evaluation_stack.pop_back();
+			assert(table_val.type() == vtype::TABLE);
+
+			table_entry& table_entry = table_entries[table_val.table_id()];
+			assert(ins.operand < table_entry.used_elems);
+			table_write_barrier(table_val.table_id(), table_entry, store_val);
+			table_elems[table_entry.block.table_start + ins.operand] = store_val;
+			evaluation_stack.push_back(store_val);
+			goto next_ins;
+		}
 
 		//control flow
 		case opcode::COND_JUMP_AHEAD:
@@ -400,56 +495,36 @@ std::variant<value, error> instance::execute() {
 			}
 		}
 
+		case opcode::IF_FALSE_JUMP_AHEAD: {
+			if (evaluation_stack.back().type() != vtype::NUMBER) {
+				current_error = type_error(vtype::NUMBER, evaluation_stack.back().type());
+				goto stop_exec;
+			}
+			if (evaluation_stack.back().number() == 0) {
+				evaluation_stack.back() = value(false);
+				current_ip += ins.operand;
+				continue;
+			}
+			goto next_ins;
+		}
+		case opcode::IF_TRUE_JUMP_AHEAD: {
+			if (evaluation_stack.back().type() != vtype::NUMBER) {
+				current_error = type_error(vtype::NUMBER, evaluation_stack.back().type());
+				goto stop_exec;
+			}
+			if (evaluation_stack.back().number() != 0) {
+				evaluation_stack.back() = value(true);
+				current_ip += ins.operand;
+				continue;
+			}
+			goto next_ins;
+		}
+
 		//function operations
-		case opcode::FUNCTION:
+		case opcode::FUNCTION: //function entries are registered by the compiler; skip over the body
 		{
-			uint32_t id = ins.operand;
-			uint32_t end_addr = current_ip;
-
-			loaded_function_entry entry = {
-				.start_address = current_ip + 1
-			};
-			spp::sparse_hash_set<uint32_t> referenced_func_ids;
-			spp::sparse_hash_set<char*> referenced_strs;
-			do {
-				switch (instructions[end_addr].op)
-				{
-				case opcode::CALL_NO_CAPUTRE_TABLE:
-					[[fallthrough]];
-				case opcode::MAKE_CLOSURE:
-					referenced_func_ids.insert(instructions[end_addr].operand);
-					break;
-				case opcode::LOAD_CONSTANT: {
-					value& constant = constants.unsafe_get(instructions[end_addr].operand);
-					if (constant.type() == vtype::STRING) {
-						referenced_strs.insert(constant.str());
-					}
-					break;
-				}
-				}
-
-				end_addr++;
-				if (end_addr == loaded_instructions.size()) {
-					std::stringstream ss;
-					ss << "No matching function end instruction for function instruction at " << end_addr << '.';
-					current_error = make_error(etype::INTERNAL_ERROR, ss.str());
-					goto stop_exec;
-				}
-			} while (instructions[end_addr].op != opcode::FUNCTION_END);
-
-			entry.referenced_func_ids.reserve(referenced_func_ids.size());
-			entry.referenced_func_ids.insert(entry.referenced_func_ids.begin(), referenced_func_ids.begin(), referenced_func_ids.end());
-			entry.referenced_const_strs.reserve(referenced_strs.size());
-			entry.referenced_const_strs.insert(entry.referenced_const_strs.begin(), referenced_strs.begin(), referenced_strs.end());
-			entry.length = end_addr - current_ip;
-			current_ip = end_addr;
-
-			instruction end_ins = instructions[current_ip];
-			entry.parameter_count = end_ins.operand;
-
-			function_entries.set(id, entry);
-
-			current_ip++;
+			loaded_function_entry& fn_entry = function_entries[ins.operand];
+			current_ip = fn_entry.start_address + fn_entry.length;
 			continue;
 		}
 		case opcode::FUNCTION_END: //automatically return if this instruction is ever reached
@@ -461,16 +536,72 @@ std::variant<value, error> instance::execute() {
 			evaluation_stack.push_back(value(ins.operand, capture_table.table_id()));
 			goto next_ins;
 		}
+		case opcode::CALL_METHOD:
+		{
+			method_call_site& site = method_call_sites[ins.operand];
+			value obj_val = evaluation_stack.back();
+			evaluation_stack.pop_back();
+
+			if (obj_val.type() == vtype::FOREIGN_RESOURCE) {
+				auto resource = get_foreign_resource(obj_val);
+				auto res = resource->load_key(site.key, *this);
+				if (std::holds_alternative<error>(res)) {
+					current_error = std::get<error>(res);
+					goto stop_exec;
+				}
+				evaluation_stack.push_back(std::get<value>(res));
+			}
+			else if (obj_val.type() != vtype::TABLE) {
+				current_error = type_error(vtype::TABLE, obj_val.type());
+				goto stop_exec;
+			}
+			else {
+				table_entry& table_entry = table_entries[obj_val.table_id()];
+
+				//a class instance with only its template keys can't shadow any method, since methods and properties never share names
+				if (table_entry.class_id.has_value() && table_entry.class_id == site.cached_class_id && table_entry.used_elems == class_entries[table_entry.class_id.value()].property_count) {
+					evaluation_stack.push_back(value(site.cached_function_id, obj_val.table_id()));
+				}
+				else {
+					uint64_t hash = site.key.compute_hash();
+
+					auto position = find_key(table_entry, site.key, hash);
+					if (position.second) {
+						evaluation_stack.push_back(table_elems[table_entry.block.table_start + keys_of(table_entry)[position.first].slot]);
+						goto call_method;
+					}
+
+					std::optional<uint32_t> method = std::nullopt;
+					if (table_entry.class_id.has_value()) {
+						method = find_method(table_entry.class_id.value(), site.key, hash);
+					}
+					if (method.has_value()) {
+						site.cached_class_id = table_entry.class_id;
+						site.cached_function_id = method.value();
+						evaluation_stack.push_back(value(method.value(), obj_val.table_id()));
+					}
+					else {
+						evaluation_stack.push_back(value());
+					}
+				}
+			}
+
+		call_method:
+			call_arg_count = site.argument_count;
+			goto call_value;
+		}
 		case opcode::CALL: 
+			call_arg_count = ins.operand;
+		call_value:
 		{
 			auto fn_val = evaluation_stack.back();
 			evaluation_stack.pop_back();
 
 			if (fn_val.type() == vtype::FOREIGN_RESOURCE) {
-				value* args = evaluation_stack.data() + (evaluation_stack.size() - ins.operand);
-				auto resource = static_cast<foreign_resource*>(fn_val.raw_ptr());
-				auto res = resource->invoke(args, ins.operand, *this);
-				evaluation_stack.erase(evaluation_stack.end() - ins.operand, evaluation_stack.end());
+				value* args = evaluation_stack.data() + (evaluation_stack.size() - call_arg_count);
+				auto resource = get_foreign_resource(fn_val);
+				auto res = resource->invoke(args, call_arg_count, *this);
+				evaluation_stack.erase(evaluation_stack.end() - call_arg_count, evaluation_stack.end());
 
 				if (std::holds_alternative<error>(res)) {
 					current_error = std::get<error>(res);
@@ -491,9 +622,9 @@ std::variant<value, error> instance::execute() {
 			evaluation_stack.push_back(value(fn_closure.second));
 
 			return_stack.push_back(current_ip);
-			loaded_function_entry& fn_entry = function_entries.unsafe_get(fn_closure.first);
+			loaded_function_entry& fn_entry = function_entries[fn_closure.first];
 
-			if (fn_entry.parameter_count != ins.operand) { //argument count mismatch
+			if (fn_entry.parameter_count != call_arg_count) { //argument count mismatch
 				std::stringstream ss;
 				ss << "Function";
 				auto func_loc = loc_from_ip(fn_entry.start_address);
@@ -501,7 +632,7 @@ std::variant<value, error> instance::execute() {
 					ss << ", at " << func_loc.value().to_print_string() << ',';
 				}
 
-				ss << " expected " << fn_entry.parameter_count << " argument(s), but got " << ins.operand << " instead.";
+				ss << " expected " << fn_entry.parameter_count << " argument(s), but got " << call_arg_count << " instead.";
 				current_error = make_error(etype::ARGUMENT_COUNT_MISMATCH, ss.str());
 				goto stop_exec;
 			}
@@ -514,7 +645,7 @@ std::variant<value, error> instance::execute() {
 		}
 		case opcode::CALL_NO_CAPUTRE_TABLE: {
 			return_stack.push_back(current_ip);
-			loaded_function_entry& fn_entry = function_entries.unsafe_get(ins.operand); 
+			loaded_function_entry& fn_entry = function_entries[ins.operand]; 
 			
 			//no parameter count check - use instruction at your own risk! 
 
@@ -529,6 +660,9 @@ std::variant<value, error> instance::execute() {
 			if (return_stack.empty()) {
 				goto stop_exec;
 			}
+			if (!frame_tables.empty()) {
+				release_frame_tables(return_stack.size());
+			}
 
 			current_ip = return_stack.back();
 			return_stack.pop_back();
@@ -562,12 +696,12 @@ std::variant<value, error> instance::execute() {
 stop_exec:
 	exec_depth--;
 	if (current_error.has_value()) {
-		garbage_collect(gc_collection_mode::FINALIZE_COLLECT_ERROR);
+		finalize_execution(gc_collection_mode::FINALIZE_COLLECT_ERROR);
 		extended_local_offset = top_level_local_offset;
 		return current_error.value();
 	}
 	else {
-		garbage_collect(gc_collection_mode::FINALIZE_COLLECT_RETURN);
+		finalize_execution(gc_collection_mode::FINALIZE_COLLECT_RETURN);
 		if (exec_depth == 0) {
 			assert(evaluation_stack.size() == 1);
 		}
@@ -577,6 +711,7 @@ stop_exec:
 		return to_return;
 	}
 #undef LOAD_OPERAND
+#undef FLATTEN_OPERAND
 #undef NORMALIZE_ARRAY_INDEX
 }
 
@@ -587,7 +722,7 @@ instance::result_t instance::call(value fn_val, std::vector<value>& args) {
 
 	auto fn_closure = fn_val.closure();
 	
-	loaded_function_entry& fn_entry = function_entries.unsafe_get(fn_closure.first);
+	loaded_function_entry& fn_entry = function_entries[fn_closure.first];
 	if (fn_entry.parameter_count != args.size()) { //argument count mismatch
 		std::stringstream ss;
 		ss << "Function";
@@ -614,15 +749,21 @@ instance::result_t instance::call(value fn_val, std::vector<value>& args) {
 }
 
 uint32_t instance::emit_function_start(std::vector<instruction>& instructions) {
-	uint32_t id;
-	if (available_function_ids.empty()) {
-		id = static_cast<uint32_t>(function_entries.size());
-		function_entries.resize(id + 1);
-	}
-	else {
-		id = available_function_ids.back();
-		available_function_ids.pop_back();
-	}
+	uint32_t id = function_entries.add(loaded_function_entry());
 	instructions.push_back({ .op = opcode::FUNCTION, .operand = id });
 	return id;
+}
+
+uint32_t instance::emit_class(std::vector<std::pair<value, uint32_t>> methods, uint32_t property_count) {
+	std::sort(methods.begin(), methods.end(), [](const std::pair<value, uint32_t>& a, const std::pair<value, uint32_t>& b) {
+		return a.first.compute_hash() < b.first.compute_hash();
+	});
+	return class_entries.add({ .methods = methods, .property_count = property_count });
+}
+
+uint32_t instance::emit_method_call_site(value name, uint32_t argument_count) {
+	return method_call_sites.add({
+		.key = name,
+		.argument_count = argument_count
+	});
 }
\ No newline at end of file
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+
+namespace HulaScript {
+	//one mark bit per slot of a slot_map, packed into words so sweeps and resets touch little memory
+	//grows on demand; slots past the end read as unmarked
+	class mark_bitmap {
+	public:
+		bool test(uint32_t slot) const {
+			size_t word = slot / 64;
+			return word < words.size() && ((words[word] >> (slot % 64)) & 1);
+		}
+
+		//returns whether the bit was clear beforehand
+		bool set(uint32_t slot) {
+			size_t word = slot / 64;
+			if (word >= words.size()) {
+				words.resize(word + 1, 0);
+			}
+
+			uint64_t bit = static_cast<uint64_t>(1) << (slot % 64);
+			if (words[word] & bit) {
+				return false;
+			}
+			words[word] |= bit;
+			return true;
+		}
+
+		//for marking from several threads at once; the bitmap must already cover the slot
+		bool set_atomic(uint32_t slot) {
+			uint64_t bit = static_cast<uint64_t>(1) << (slot % 64);
+			std::atomic_ref<uint64_t> word(words[slot / 64]);
+			return !(word.fetch_or(bit, std::memory_order_relaxed) & bit);
+		}
+
+		void reset(uint32_t slot) {
+			size_t word = slot / 64;
+			if (word < words.size()) {
+				words[word] &= ~(static_cast<uint64_t>(1) << (slot % 64));
+			}
+		}
+
+		void assign(uint32_t slot, bool marked) {
+			if (marked) {
+				set(slot);
+			}
+			else {
+				reset(slot);
+			}
+		}
+
+		void reserve(uint32_t slot_count) {
+			size_t word_count = (static_cast<size_t>(slot_count) + 63) / 64;
+			if (word_count > words.size()) {
+				words.resize(word_count, 0);
+			}
+		}
+
+		void clear() {
+			std::fill(words.begin(), words.end(), 0);
+		}
+	private:
+		std::vector<uint64_t> words;
+	};
+}
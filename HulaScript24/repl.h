@@ -11,7 +11,14 @@
 namespace HulaScript {
 	class repl_instance {
 	public:
-		repl_instance(std::optional<std::string> name, uint32_t max_locals, uint32_t max_globals, size_t max_table) : name(name), instance(max_locals, max_globals, max_table), compiler(instance, true), eval_no(0) { }
+		repl_instance(std::optional<std::string> name, uint32_t max_locals, uint32_t max_globals, size_t max_table, allocator& str_allocator = allocator::system()) : name(name), instance(max_locals, max_globals, max_table, str_allocator), compiler(instance, true), eval_no(0) { }
+
+		//a copy of source after its prelude has run; only valid between evaluations
+		repl_instance(repl_instance& source, allocator& str_allocator) : instance(source.instance, str_allocator), compiler(source.compiler, instance), name(source.name), eval_no(source.eval_no) { }
+
+		std::unique_ptr<repl_instance> clone(allocator& str_allocator = allocator::system()) {
+			return std::make_unique<repl_instance>(*this, str_allocator);
+		}
 
 		//input is a piece of the source. The function will return when the source is complete enough for evaluation
 		std::variant<bool, Compilation::error> write_input(std::string input);
@@ -31,6 +38,30 @@ namespace HulaScript {
 			return true;
 		}
 
+		void set_incremental_gc(std::optional<uint32_t> step_budget) {
+			instance.set_incremental_gc(step_budget);
+		}
+
+		void set_generational_gc(std::optional<uint32_t> nursery_elems) {
+			instance.set_generational_gc(nursery_elems);
+		}
+
+		void set_evaluation_region(std::optional<uint32_t> region_elems) {
+			instance.set_evaluation_region(region_elems);
+		}
+
+		void set_high_density(bool enabled) {
+			instance.set_high_density(enabled);
+		}
+
+		void hibernate() {
+			instance.hibernate();
+		}
+
+		void set_parallel_gc(uint32_t thread_count, size_t min_heap_elems) {
+			instance.set_parallel_gc(thread_count, min_heap_elems);
+		}
+
 		bool declare_func(std::string name, Runtime::instance::result_t(*func)(Runtime::value*, uint32_t, Runtime::instance&), std::optional<uint32_t> expected_params) {
 			return declare_global(name, instance.make_foreign_resource(new Runtime::foreign_function(name, func, expected_params)));
 		}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstdint>
+#include <cassert>
+#include <vector>
+#include <optional>
+
+namespace HulaScript {
+	//a dense id space backed by contiguous storage and a free list
+	//the low index_bits of an id are its slot; the remaining bits hold the slot's generation, which changes whenever the slot is reused so stale ids trip an assertion in debug builds
+	//a slot whose generation would no longer fit in those bits is retired rather than reused, so ids never alias
+	template<typename T, typename id_type, int index_bits>
+	class slot_map {
+	public:
+		id_type add(const T& elem) {
+			uint32_t slot;
+			if (free_slots.empty()) {
+				slot = static_cast<uint32_t>(elems.size());
+				assert(slot <= index_mask);
+				elems.push_back(elem);
+				generations.push_back(0);
+			}
+			else {
+				slot = free_slots.back();
+				free_slots.pop_back();
+				elems[slot] = elem;
+			}
+			generations[slot]++; //odd generations are occupied
+			return make_id(slot);
+		}
+
+		void remove(id_type id) {
+			assert(contains(id));
+			uint32_t slot = static_cast<uint32_t>(id & index_mask);
+			elems[slot] = T();
+			generations[slot]++;
+			if (static_cast<uint64_t>(generations[slot]) + 1 < generation_limit) {
+				free_slots.push_back(slot);
+			}
+		}
+
+		T& operator[](id_type id) {
+			assert(contains(id));
+			return elems[id & index_mask];
+		}
+
+		const T& operator[](id_type id) const {
+			assert(contains(id));
+			return elems[id & index_mask];
+		}
+
+		bool contains(id_type id) const {
+			uint32_t slot = static_cast<uint32_t>(id & index_mask);
+			return slot < elems.size() && (generations[slot] & 1) && make_id(slot) == id;
+		}
+
+		//slots are numbered from zero up to slot_count; vacant slots have no id
+		uint32_t slot_count() const {
+			return static_cast<uint32_t>(elems.size());
+		}
+
+		static uint32_t slot_of(id_type id) {
+			return static_cast<uint32_t>(id & index_mask);
+		}
+
+		std::optional<id_type> id_at(uint32_t slot) const {
+			if (generations[slot] & 1) {
+				return make_id(slot);
+			}
+			return std::nullopt;
+		}
+
+		void shrink_to_fit() {
+			free_slots.shrink_to_fit();
+		}
+
+		//also gives up the vacant slots at the end; their generations start over if they're reused, so only call this when no stale ids are held
+		void trim() {
+			while (!generations.empty() && !(generations.back() & 1)) {
+				elems.pop_back();
+				generations.pop_back();
+			}
+			std::erase_if(free_slots, [this](uint32_t slot) -> bool { return slot >= elems.size(); });
+
+			elems.shrink_to_fit();
+			generations.shrink_to_fit();
+			free_slots.shrink_to_fit();
+		}
+	private:
+		static constexpr id_type index_mask = (static_cast<id_type>(1) << index_bits) - 1;
+		static constexpr uint64_t generation_limit = static_cast<uint64_t>(1) << (sizeof(id_type) * 8 - index_bits);
+
+		std::vector<T> elems;
+		std::vector<uint32_t> generations;
+		std::vector<uint32_t> free_slots;
+
+		id_type make_id(uint32_t slot) const {
+			return static_cast<id_type>(static_cast<id_type>(generations[slot]) << index_bits) | slot;
+		}
+	};
+}
@@ -163,7 +163,8 @@ std::variant<token, error> tokenizer::scan_token() {
 	}
 	else if (isdigit(last_char)) {
 		std::stringstream numerical_ss;
-		while (isdigit(last_char) || last_char == '.') {
+		//a period followed by another is a concatenation, as in 1..x
+		while (isdigit(last_char) || (last_char == '.' && (pos == source.size() || source.at(pos) != '.'))) {
 			numerical_ss << last_char;
 			scan_char();
 		}
@@ -208,6 +209,10 @@ std::variant<token, error> tokenizer::scan_token() {
 		case ']':
 			return last_tok = token(token_type::CLOSE_BRACKET);
 		case '.':
+			if (last_char == '.') {
+				scan_char();
+				return last_tok = token(token_type::CONCAT);
+			}
 			return last_tok = token(token_type::PERIOD);
 		case ',':
 			return last_tok = token(token_type::COMMA);
@@ -337,6 +342,7 @@ error tokenizer::make_unexpected_tok_err(std::optional<token_type> expected) {
 		"AND",
 		"OR",
 		"NIL COALEASING OPERATOR",
+		"CONCAT",
 
 		"NOT",
 		"SET",
@@ -63,6 +63,7 @@ namespace HulaScript::Compilation {
 		AND,
 		OR,
 		NIL_COALESING,
+		CONCAT,
 
 		NOT,
 		SET,
@@ -3,6 +3,7 @@
 #include <cstdlib>
 #include <cstdint>
 #include <utility>
+#include "allocator.h"
 
 namespace HulaScript::Runtime {
 	enum vtype {
@@ -12,8 +13,42 @@ namespace HulaScript::Runtime {
 		NUMBER = 1,
 		NIL = 0,
 
-		FOREIGN_RESOURCE = 5,
-		INTERNAL_CONSTHASH = 7
+		FOREIGN_RESOURCE = 5
+	};
+
+	struct string_header;
+
+	//the lazy concatenation of two strings; flattened into a single buffer the first time its characters or hash are needed
+	struct rope_node {
+		string_header* left;
+		string_header* right;
+		char* flattened; //null until flattened; the children are released afterwards
+		allocator* flattened_allocator; //the owning instance's allocator, since flattening happens wherever a hash or the characters are needed
+	};
+
+	//strings are allocated as a header immediately followed by either their null-terminated characters or, for ropes, a rope node
+	struct string_header {
+		uint64_t hash; //hash of the characters, computed once the string is flat
+		uint32_t length;
+		bool marked; //garbage collector mark bit
+		bool interned; //interned strings are unique by content, so they can be compared by address
+		bool is_rope;
+
+		rope_node* rope() {
+			return reinterpret_cast<rope_node*>(this + 1);
+		}
+
+		bool is_flat() {
+			return !is_rope || rope()->flattened != NULL;
+		}
+
+		//only valid for flat strings
+		char* chars() {
+			return is_rope ? rope()->flattened : reinterpret_cast<char*>(this + 1);
+		}
+
+		//returns false, leaving the rope as it is, if the buffer can't be allocated
+		bool flatten();
 	};
 
 	struct value {
@@ -21,12 +56,11 @@ namespace HulaScript::Runtime {
 		value() : _type(vtype::NIL), func_id(0), data({ .str = NULL }) {}
 		value(double number) : _type(vtype::NUMBER), func_id(0), data({.number = number}) { }
 		value(bool b) : _type(vtype::NUMBER), func_id(0), data({.number = b ? 1.0 : 0.0}) { }
-		value(char* raw_cstr) : _type(vtype::STRING), func_id(0), data({.str = raw_cstr}) { }
+		value(string_header* str) : _type(vtype::STRING), func_id(0), data({.str = str}) { }
 		value(uint64_t raw_table_id) : _type(vtype::TABLE), func_id(0), data({.table_id = raw_table_id}) { }
 		value(uint32_t raw_func_id, uint64_t raw_table_id) : _type(vtype::CLOSURE), func_id(raw_func_id), data({.table_id = raw_table_id}) { }
 
 		value(vtype type, uint64_t raw_data) : _type(type), func_id(0), data({.table_id = raw_data}){ }
-		value(vtype type, void* raw_id) : _type(type), func_id(0), data({ .ptr = raw_id }) { }
 
 		constexpr vtype type() const {
 			return _type;
@@ -36,7 +70,7 @@ namespace HulaScript::Runtime {
 			return data.number;
 		}
 
-		constexpr char* str() const {
+		constexpr string_header* str() const {
 			return data.str;
 		}
 
@@ -48,15 +82,15 @@ namespace HulaScript::Runtime {
 			return std::make_pair(func_id, data.table_id);
 		}
 
-		constexpr void* raw_ptr() const {
-			return data.ptr;
+		constexpr uint32_t foreign_id() const {
+			return static_cast<uint32_t>(data.table_id);
 		}
 
 		//computes a unique value hash
 		const uint64_t compute_hash() const;
 
-		//computes a hash specifically to represent value keys
-		const uint64_t compute_key_hash() const;
+		//compares values by contents; equal values always have equal hashes, but equal hashes don't imply equal values
+		const bool equals(const value& other) const;
 
 		//std::string to_print_string();
 	private:
@@ -67,8 +101,7 @@ namespace HulaScript::Runtime {
 		union vdata {
 			double number;
 			uint64_t table_id;
-			char* str;
-			void* ptr;
+			string_header* str;
 		} data;
 	};
 }
\ No newline at end of file
@@ -2,6 +2,7 @@
 #include <cassert>
 #include <string>
 #include <sstream>
+#include <vector>
 #include "hash.h"
 #include "value.h"
 #include "instance.h"
@@ -17,15 +18,17 @@ const uint64_t value::compute_hash() const {
 		break;
 	case vtype::FOREIGN_RESOURCE:
 		[[fallthrough]];
-	case vtype::INTERNAL_CONSTHASH:
-		[[fallthrough]];
 	case vtype::NUMBER:
 		[[fallthrough]];
 	case vtype::TABLE:
 		init_hash = data.table_id;
 		break;
 	case vtype::STRING:
-		init_hash = str_hash(data.str);
+		if (!data.str->is_flat()) {
+			bool flattened = data.str->flatten();
+			assert(flattened); //the interpreter flattens keys itself, so it can report running out of memory
+		}
+		init_hash = data.str->hash;
 		break;
 	case vtype::NIL:
 		return 0;
@@ -34,13 +37,72 @@ const uint64_t value::compute_hash() const {
 	return hash_combine(init_hash, (uint64_t)_type);
 }
 
-const uint64_t value::compute_key_hash() const {
+//copies the leaves of the rope into one buffer; iterative, since ropes built in loops are very deep
+bool string_header::flatten() {
+	assert(!is_flat());
+
+	char* buffer = (char*)rope()->flattened_allocator->allocate(length + 1);
+	if (buffer == NULL) {
+		return false;
+	}
+
+	std::vector<string_header*> to_copy;
+	to_copy.push_back(this);
+	uint32_t offset = 0;
+	while (!to_copy.empty()) {
+		string_header* current = to_copy.back();
+		to_copy.pop_back();
+
+		if (current->is_flat()) {
+			std::memcpy(buffer + offset, current->chars(), current->length);
+			offset += current->length;
+		}
+		else {
+			to_copy.push_back(current->rope()->right);
+			to_copy.push_back(current->rope()->left);
+		}
+	}
+	buffer[length] = '\0';
+
+	rope()->flattened = buffer;
+	rope()->left = NULL;
+	rope()->right = NULL;
+	hash = key_str_hash(buffer, length);
+	return true;
+}
+
+const bool value::equals(const value& other) const {
+	if (_type != other._type) {
+		return false;
+	}
+
 	switch (_type)
 	{
-	case vtype::INTERNAL_CONSTHASH:
-		return data.table_id;
+	case vtype::CLOSURE:
+		return func_id == other.func_id && data.table_id == other.data.table_id;
+	case vtype::STRING:
+		if (data.str == other.data.str) {
+			return true;
+		}
+		if (data.str->interned && other.data.str->interned) {
+			return false;
+		}
+		if (data.str->length != other.data.str->length) {
+			return false;
+		}
+		if (!data.str->is_flat()) {
+			bool flattened = data.str->flatten();
+			assert(flattened); //likewise for compared strings
+		}
+		if (!other.data.str->is_flat()) {
+			bool flattened = other.data.str->flatten();
+			assert(flattened);
+		}
+		return data.str->hash == other.data.str->hash && data.str->length == other.data.str->length && std::memcmp(data.str->chars(), other.data.str->chars(), data.str->length) == 0;
+	case vtype::NIL:
+		return true;
 	default:
-		return compute_hash();
+		return data.table_id == other.data.table_id; //numbers compare bitwise, consistent with compute_hash
 	}
 }
 
@@ -53,7 +115,7 @@ std::string instance::value_to_print_str(value& val) const {
 		std::stringstream ss;
 		ss << "closure(func_id=" << closure.first << ", capture_table=";
 
-		table_entry& entry = table_entries.unsafe_get(closure.second);
+		const table_entry& entry = table_entries[closure.second];
 		ss << '[';
 		for (uint_fast32_t i = 0; i < entry.used_elems; i++) {
 			if (i > 0) {
@@ -65,7 +127,7 @@ std::string instance::value_to_print_str(value& val) const {
 		return ss.str();
 	}
 	case HulaScript::Runtime::TABLE: {
-		table_entry& entry = table_entries.unsafe_get(val.table_id());
+		const table_entry& entry = table_entries[val.table_id()];
 
 		std::stringstream ss;
 		ss << '[';
@@ -78,14 +140,33 @@ std::string instance::value_to_print_str(value& val) const {
 		ss << ']';
 		return ss.str();
 	}
-	case HulaScript::Runtime::STRING:
-		return std::string(val.str());
+	case HulaScript::Runtime::STRING: {
+		//ropes are streamed leaf by leaf rather than flattened
+		std::string str;
+		str.reserve(val.str()->length);
+
+		std::vector<string_header*> to_print;
+		to_print.push_back(val.str());
+		while (!to_print.empty()) {
+			string_header* current = to_print.back();
+			to_print.pop_back();
+
+			if (current->is_flat()) {
+				str.append(current->chars(), current->length);
+			}
+			else {
+				to_print.push_back(current->rope()->right);
+				to_print.push_back(current->rope()->left);
+			}
+		}
+		return str;
+	}
 	case HulaScript::Runtime::NUMBER:
 		return std::to_string(val.number());
 	case HulaScript::Runtime::NIL:
 		return "nil";
 	case HulaScript::Runtime::FOREIGN_RESOURCE: {
-		foreign_resource* resource = static_cast<foreign_resource*>(val.raw_ptr());
+		foreign_resource* resource = get_foreign_resource(val);
 		return resource->to_print_string();
 	}
 	default:
@@ -0,0 +1,105 @@
+#include <cassert>
+#include <algorithm>
+#include "virtual_arena.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+using namespace HulaScript;
+
+static size_t system_page_size() {
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwPageSize;
+#else
+	return static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif
+}
+
+virtual_arena::virtual_arena(size_t reserved_bytes) : committed(0), page_size(system_page_size()) {
+	reserved = (std::max(reserved_bytes, static_cast<size_t>(1)) + page_size - 1) / page_size * page_size;
+
+#ifdef _WIN32
+	base = static_cast<char*>(VirtualAlloc(NULL, reserved, MEM_RESERVE, PAGE_NOACCESS));
+#else
+	void* res = mmap(NULL, reserved, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	base = static_cast<char*>(res == MAP_FAILED ? NULL : res);
+#endif
+	assert(base != NULL);
+}
+
+virtual_arena::~virtual_arena() {
+#ifdef _WIN32
+	VirtualFree(base, 0, MEM_RELEASE);
+#else
+	munmap(base, reserved);
+#endif
+}
+
+bool virtual_arena::commit_pages(size_t offset, size_t bytes) {
+#ifdef _WIN32
+	return VirtualAlloc(base + offset, bytes, MEM_COMMIT, PAGE_READWRITE) != NULL;
+#else
+	return mprotect(base + offset, bytes, PROT_READ | PROT_WRITE) == 0;
+#endif
+}
+
+bool virtual_arena::commit_prefix(size_t bytes) {
+	if (bytes > reserved) {
+		return false;
+	}
+
+	size_t start = committed / page_size * page_size;
+	size_t end = (bytes + page_size - 1) / page_size * page_size;
+	if (!commit_pages(start, end - start)) {
+		return false;
+	}
+	committed = end;
+	return true;
+}
+
+bool virtual_arena::commit_range(size_t offset, size_t bytes) {
+	if (offset + bytes > reserved) {
+		return false;
+	}
+	if (bytes == 0) {
+		return true;
+	}
+
+	size_t start = offset / page_size * page_size;
+	size_t end = (offset + bytes + page_size - 1) / page_size * page_size;
+	return commit_pages(start, end - start);
+}
+
+void virtual_arena::decommit_pages(size_t offset, size_t bytes) {
+#ifdef _WIN32
+	VirtualFree(base + offset, bytes, MEM_DECOMMIT);
+#else
+	madvise(base + offset, bytes, MADV_DONTNEED);
+	mprotect(base + offset, bytes, PROT_NONE);
+#endif
+}
+
+void virtual_arena::decommit(size_t offset, size_t end) {
+	size_t start = (offset + page_size - 1) / page_size * page_size;
+	size_t stop = std::min(end, committed) / page_size * page_size;
+	if (start < stop) {
+		decommit_pages(start, stop - start);
+	}
+	committed = std::min(committed, offset);
+}
+
+void virtual_arena::decommit_range(size_t offset, size_t bytes) {
+	size_t start = (offset + page_size - 1) / page_size * page_size;
+	size_t stop = std::min(offset + bytes, reserved) / page_size * page_size;
+	if (start < stop) {
+		decommit_pages(start, stop - start);
+	}
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+
+namespace HulaScript {
+	//a range of address space reserved up front, with physical memory committed only as it's needed
+	//the reservation is a hard limit: the arena never moves, so pointers into it stay valid as it grows
+	class virtual_arena {
+	public:
+		virtual_arena(size_t reserved_bytes);
+		~virtual_arena();
+
+		virtual_arena(const virtual_arena&) = delete;
+		virtual_arena& operator=(const virtual_arena&) = delete;
+
+		void* data() const {
+			return base;
+		}
+
+		//makes [0, bytes) usable; fails past the reservation or if the os is out of memory
+		bool commit(size_t bytes) {
+			return bytes <= committed || commit_prefix(bytes);
+		}
+
+		//makes [offset, offset + bytes) usable without extending the committed prefix, for regions kept at the top of the reservation
+		bool commit_range(size_t offset, size_t bytes);
+
+		//returns the whole pages of the committed prefix that lie in [offset, end) to the os, shrinking the prefix to offset
+		void decommit(size_t offset, size_t end);
+
+		//returns the whole pages in [offset, offset + bytes) to the os, for regions committed with commit_range
+		void decommit_range(size_t offset, size_t bytes);
+	private:
+		char* base;
+		size_t reserved;
+		size_t committed;
+		size_t page_size;
+
+		bool commit_prefix(size_t bytes);
+		bool commit_pages(size_t offset, size_t bytes);
+		void decommit_pages(size_t offset, size_t bytes);
+	};
+}